@@ -54,24 +54,26 @@ void Application::Initialize() {
 	m_initializeThreadPoolTable();
 	m_initializeWindow();
 	m_initializeRenderer();
+	m_initializeECS();
 	m_initializeDebugTools();
 }
 
 void Application::Update() {
 	// ECSの更新はデバッグGUIより前
-	// m_ecs_host->Update(); // まだ実装がないので
+	m_ecs_host->Update();
 	m_debug_gui_host->Update();
 }
 
 void Application::SubmitRenderTask() {
 	// ECSのレンダリングタスクはデバッグGUIより前
-	// m_ecs_host->SubmitRenderTask();
+	m_ecs_host->SubmitRenderTask();
 	m_debug_gui_host->SubmitRenderTask();
 }
 
 void Application::Finalize() {
 	m_logger->info("Finalizing application...");
 
+	m_ecs_host.reset();
 	m_thread_pool_table.reset();
 	m_renderer.reset();
 	m_window.reset();
@@ -132,6 +134,13 @@ void Application::m_initializeRenderer() {
 	);
 }
 
+void Application::m_initializeECS() {
+	m_thread_pool_table->Allocate<Constants::StringLiterals::EcsThreadPoolName>();
+
+	m_ecs_host = std::make_shared<ECS::ECSHost>(
+		m_thread_pool_table->GetThreadPool<Constants::StringLiterals::EcsThreadPoolName>());
+}
+
 void Application::m_initializeDebugTools() {
 	m_debug_gui_host = std::make_shared<DebugTools::DebugGUIHost>(m_window, m_renderer);
 }
@@ -7,6 +7,7 @@
 #include "graphics/renderer.hpp"
 #include "thread/thread_pool_table.hpp"
 #include "debug_tools/debug_gui_host.hpp"
+#include "ecs/ecs_host.hpp"
 #include "constants/thread_pool_table_ids.hpp"
 
 namespace PameECS {
@@ -39,6 +40,7 @@ namespace PameECS {
 		void m_initializeThreadPoolTable();
 		void m_initializeWindow();
 		void m_initializeRenderer();
+		void m_initializeECS();
 		void m_initializeDebugTools();
 
 		std::shared_ptr<spdlog::logger> m_logger;
@@ -47,6 +49,7 @@ namespace PameECS {
 		std::shared_ptr
 			<Thread::ThreadPoolTable<false, static_cast<size_t>(Constants::ThreadPoolTableIds::ApplicationMain)>>
 			m_thread_pool_table;
+		std::shared_ptr<ECS::ECSHost> m_ecs_host;
 		std::shared_ptr<DebugTools::DebugGUIHost> m_debug_gui_host;
 	};
 
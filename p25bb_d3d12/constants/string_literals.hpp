@@ -3,4 +3,5 @@
 
 namespace PameECS::Constants::StringLiterals {
 	inline constexpr auto RendererThreadPoolName = TemplateTypes::StringLiteral("RendererThreadPool");
+	inline constexpr auto EcsThreadPoolName = TemplateTypes::StringLiteral("EcsThreadPool");
 }
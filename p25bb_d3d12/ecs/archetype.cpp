@@ -0,0 +1,129 @@
+#include "archetype.hpp"
+#include <cassert>
+#include <limits>
+#include "../exceptions/invalid_operation.hpp"
+#include "../helpers/binary.hpp"
+
+using PameECS::ECS::Archetype;
+using PameECS::Helpers::Binary::AlignUp;
+
+Archetype::Archetype(size_t index, std::vector<const ComponentInfo*> components)
+	: m_index(index) {
+	m_signature.reserve(components.size());
+	m_columns.reserve(components.size());
+	for (const ComponentInfo* info : components) {
+		assert(m_signature.empty() || m_signature.back() < info->id);
+		if (info->alignment > m_column_alignment) {
+			throw Exceptions::InvalidOperation("The component alignment is larger than the chunk alignment.");
+		}
+		m_signature.emplace_back(info->id);
+		m_columns.push_back({ info, 0 });
+	}
+
+	if (!m_signature.empty()) {
+		m_column_by_type.assign(static_cast<size_t>(m_signature.back()) + 1, npos);
+		for (size_t i = 0; i < m_signature.size(); ++i) {
+			m_column_by_type[m_signature[i]] = i;
+		}
+	}
+
+	// 列の間の詰め物を見込んで多めに見積もり、収まるまで減らす
+	size_t bytesPerEntity = sizeof(Entity);
+	for (const auto& column : m_columns) {
+		bytesPerEntity += column.info->size;
+	}
+	const size_t padding = (m_columns.size() + 1) * m_column_alignment;
+	uint32_t capacity = static_cast<uint32_t>(chunkBytes > padding ? (chunkBytes - padding) / bytesPerEntity : 0);
+	while (capacity > 1 && m_layoutColumns(capacity) > chunkBytes) {
+		--capacity;
+	}
+
+	// 1つも入らないほど大きいコンポーネントがあれば、1つ分の大きさのチャンクにする
+	m_chunk_capacity = std::max<uint32_t>(1, capacity);
+	m_chunk_bytes = std::max(chunkBytes, m_layoutColumns(m_chunk_capacity));
+}
+
+Archetype::~Archetype() {
+	for (size_t chunkIndex = 0; chunkIndex < GetChunkCount(); ++chunkIndex) {
+		const uint32_t count = GetChunkEntityCount(chunkIndex);
+		for (size_t columnIndex = 0; columnIndex < m_columns.size(); ++columnIndex) {
+			m_columns[columnIndex].info->destroy(GetColumnData(chunkIndex, columnIndex), count);
+		}
+	}
+}
+
+uint32_t Archetype::PushRow(Entity entity) {
+	if (m_entity_count == std::numeric_limits<uint32_t>::max()) {
+		throw Exceptions::InvalidOperation("Too many entities in the archetype.");
+	}
+
+	const uint32_t row = m_entity_count;
+	const size_t chunkIndex = row / m_chunk_capacity;
+	if (chunkIndex == m_chunks.size()) {
+		m_chunks.emplace_back(static_cast<std::byte*>(::operator new(m_chunk_bytes, std::align_val_t{ m_column_alignment })));
+	}
+
+	reinterpret_cast<Entity*>(m_chunks[chunkIndex].get())[row % m_chunk_capacity] = entity;
+	++m_entity_count;
+	return row;
+}
+
+uint32_t Archetype::PushRows(std::span<const Entity> entities) {
+	if (entities.size() > std::numeric_limits<uint32_t>::max() - m_entity_count) {
+		throw Exceptions::InvalidOperation("Too many entities in the archetype.");
+	}
+
+	const uint32_t firstRow = m_entity_count;
+	const size_t chunkCount = (static_cast<size_t>(firstRow) + entities.size() + m_chunk_capacity - 1) / m_chunk_capacity;
+	m_chunks.reserve(chunkCount);
+	while (m_chunks.size() < chunkCount) {
+		m_chunks.emplace_back(static_cast<std::byte*>(::operator new(m_chunk_bytes, std::align_val_t{ m_column_alignment })));
+	}
+
+	for (size_t i = 0; i < entities.size(); ++i) {
+		const size_t row = static_cast<size_t>(firstRow) + i;
+		reinterpret_cast<Entity*>(m_chunks[row / m_chunk_capacity].get())[row % m_chunk_capacity] = entities[i];
+	}
+	m_entity_count += static_cast<uint32_t>(entities.size());
+	return firstRow;
+}
+
+void Archetype::DestroyRow(uint32_t row) noexcept {
+	for (size_t columnIndex = 0; columnIndex < m_columns.size(); ++columnIndex) {
+		m_columns[columnIndex].info->destroy(GetComponentData(row, columnIndex), 1);
+	}
+}
+
+PameECS::ECS::Entity Archetype::EraseRow(uint32_t row) noexcept {
+	assert(row < m_entity_count);
+
+	const uint32_t last = m_entity_count - 1;
+	Entity moved;
+	if (row != last) {
+		for (size_t columnIndex = 0; columnIndex < m_columns.size(); ++columnIndex) {
+			m_columns[columnIndex].info->relocate(GetComponentData(row, columnIndex), GetComponentData(last, columnIndex), 1);
+		}
+		moved = GetEntity(last);
+		reinterpret_cast<Entity*>(m_chunks[row / m_chunk_capacity].get())[row % m_chunk_capacity] = moved;
+	}
+
+	--m_entity_count;
+
+	// 使っているチャンクの次の1つだけを残して解放する
+	while (m_chunks.size() > GetChunkCount() + 1) {
+		m_chunks.pop_back();
+	}
+
+	return moved;
+}
+
+size_t Archetype::m_layoutColumns(uint32_t capacity) {
+	size_t offset = sizeof(Entity) * capacity;
+	for (auto& column : m_columns) {
+		offset = AlignUp(offset, std::max(column.info->alignment, m_column_alignment));
+		column.offset = offset;
+		offset += column.info->size * capacity;
+	}
+
+	return offset;
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "entity.hpp"
+#include "component.hpp"
+
+namespace PameECS::ECS {
+	// 同じコンポーネントの組み合わせを持つエンティティをまとめて格納する
+	// データは固定サイズのチャンクに分け、チャンク内ではコンポーネント毎に連続した配列(SoA)で並べる
+	// 行はアーキタイプ内の通し番号で、チャンクの番号は行 / GetChunkCapacity()、チャンク内の位置は行 % GetChunkCapacity()
+	// スレッドセーフではない
+	class Archetype {
+	public:
+		inline static constexpr size_t chunkBytes = 16 * 1024;
+		inline static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+		struct Column {
+			const ComponentInfo* info;
+			size_t offset; // チャンクの先頭からの位置
+		};
+
+		// indexはワールドの中で作られた順番、componentsはIDの昇順で重複がないこと
+		Archetype(size_t index, std::vector<const ComponentInfo*> components);
+		// 残っているコンポーネントを全て破棄する
+		~Archetype();
+		Archetype(const Archetype&) = delete;
+		Archetype& operator=(const Archetype&) = delete;
+
+		size_t GetIndex() const noexcept {
+			return m_index;
+		}
+		// IDの昇順
+		std::span<const ComponentTypeId> GetSignature() const noexcept {
+			return m_signature;
+		}
+		std::span<const Column> GetColumns() const noexcept {
+			return m_columns;
+		}
+		// 持っていなければnpos
+		size_t FindColumn(ComponentTypeId id) const noexcept {
+			return id < m_column_by_type.size() ? m_column_by_type[id] : npos;
+		}
+		bool HasComponent(ComponentTypeId id) const noexcept {
+			return FindColumn(id) != npos;
+		}
+
+		uint32_t GetEntityCount() const noexcept {
+			return m_entity_count;
+		}
+		uint32_t GetChunkCapacity() const noexcept {
+			return m_chunk_capacity;
+		}
+		// エンティティが入っているチャンクの数
+		size_t GetChunkCount() const noexcept {
+			return (static_cast<size_t>(m_entity_count) + m_chunk_capacity - 1) / m_chunk_capacity;
+		}
+		uint32_t GetChunkEntityCount(size_t chunkIndex) const noexcept {
+			const size_t begin = chunkIndex * m_chunk_capacity;
+			return static_cast<uint32_t>(std::min<size_t>(m_chunk_capacity, m_entity_count - begin));
+		}
+		const Entity* GetEntities(size_t chunkIndex) const noexcept {
+			return reinterpret_cast<const Entity*>(m_chunks[chunkIndex].get());
+		}
+		void* GetColumnData(size_t chunkIndex, size_t columnIndex) const noexcept {
+			return m_chunks[chunkIndex].get() + m_columns[columnIndex].offset;
+		}
+
+		Entity GetEntity(uint32_t row) const noexcept {
+			return GetEntities(row / m_chunk_capacity)[row % m_chunk_capacity];
+		}
+		void* GetComponentData(uint32_t row, size_t columnIndex) const noexcept {
+			return static_cast<std::byte*>(GetColumnData(row / m_chunk_capacity, columnIndex))
+				+ static_cast<size_t>(row % m_chunk_capacity) * m_columns[columnIndex].info->size;
+		}
+
+		// 末尾に行を追加してその行を返す、コンポーネントは未初期化なので呼び出し側で構築すること
+		uint32_t PushRow(Entity entity);
+		// 末尾にentitiesの数だけ行を追加して最初の行を返す、例外を投げた場合は何も追加しない
+		uint32_t PushRows(std::span<const Entity> entities);
+		// rowのコンポーネントを全て破棄する、行はそのまま残る
+		void DestroyRow(uint32_t row) noexcept;
+		// rowを末尾の行で埋めて取り除き、rowに移ってきたエンティティを返す(rowが末尾であれば無効なエンティティ)
+		// rowのコンポーネントは、破棄済みかムーブ済みであること
+		Entity EraseRow(uint32_t row) noexcept;
+
+		// コンポーネントを1つ追加、削除した先のアーキタイプ、まだ辿っていなければnullptr
+		Archetype* GetAddEdge(ComponentTypeId id) const {
+			auto it = m_add_edges.find(id);
+			return it != m_add_edges.end() ? it->second : nullptr;
+		}
+		Archetype* GetRemoveEdge(ComponentTypeId id) const {
+			auto it = m_remove_edges.find(id);
+			return it != m_remove_edges.end() ? it->second : nullptr;
+		}
+		void SetAddEdge(ComponentTypeId id, Archetype* archetype) {
+			m_add_edges[id] = archetype;
+		}
+		void SetRemoveEdge(ComponentTypeId id, Archetype* archetype) {
+			m_remove_edges[id] = archetype;
+		}
+	private:
+		// 列の先頭はキャッシュラインに揃える
+		inline static constexpr size_t m_column_alignment = 64;
+
+		struct ChunkDeleter {
+			void operator()(std::byte* data) const noexcept {
+				::operator delete(data, std::align_val_t{ m_column_alignment });
+			}
+		};
+		using ChunkData = std::unique_ptr<std::byte, ChunkDeleter>;
+
+		// capacity個のエンティティを入れる場合の列の位置を計算し、チャンクに必要なバイト数を返す
+		size_t m_layoutColumns(uint32_t capacity);
+
+		size_t m_index;
+		std::vector<ComponentTypeId> m_signature;
+		std::vector<Column> m_columns;
+		// コンポーネントのIDから列のインデックスを引く表、持っていないIDはnpos
+		std::vector<size_t> m_column_by_type;
+
+		size_t m_chunk_bytes = chunkBytes;
+		uint32_t m_chunk_capacity = 0;
+		// 追加と削除を繰り返した時に確保と解放を繰り返さないように、空のチャンクを1つまで残す
+		std::vector<ChunkData> m_chunks;
+		uint32_t m_entity_count = 0;
+
+		std::unordered_map<ComponentTypeId, Archetype*> m_add_edges;
+		std::unordered_map<ComponentTypeId, Archetype*> m_remove_edges;
+	};
+}
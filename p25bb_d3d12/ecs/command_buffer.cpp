@@ -0,0 +1,89 @@
+#include "command_buffer.hpp"
+#include "../exceptions/invalid_operation.hpp"
+#include "../helpers/binary.hpp"
+
+using PameECS::ECS::CommandBuffer;
+using PameECS::Helpers::Binary::AlignUp;
+
+void CommandBuffer::Clear() noexcept {
+	m_rollback(0);
+	m_commands.clear();
+	m_current_page = 0;
+	m_current_page_used = 0;
+}
+
+void CommandBuffer::Splice(CommandBuffer& other) {
+	if (&other == this || other.IsEmpty()) {
+		return;
+	}
+
+	// 先に全て確保しておき、移す途中で例外が起きないようにする
+	m_commands.reserve(m_commands.size() + other.m_commands.size());
+	m_values.reserve(m_values.size() + other.m_values.size());
+	m_pages.reserve(m_pages.size() + other.m_pages.size());
+
+	const uint32_t valueOffset = static_cast<uint32_t>(m_values.size());
+	for (Command command : other.m_commands) {
+		command.firstValue += valueOffset;
+		m_commands.emplace_back(command);
+	}
+	m_values.insert(m_values.end(), other.m_values.begin(), other.m_values.end());
+
+	// otherの使用中のページは今のページの直後に入れて、続きの記録で上書きしないようにその最後のページから記録を続ける
+	// 使っていないページは末尾に付けて使い回す
+	if (!other.m_pages.empty()) {
+		const size_t usedPageCount = other.m_current_page + 1;
+		const size_t insertPosition = m_pages.empty() ? 0 : m_current_page + 1;
+		m_pages.insert(
+			m_pages.begin() + insertPosition,
+			std::make_move_iterator(other.m_pages.begin()),
+			std::make_move_iterator(other.m_pages.begin() + usedPageCount));
+		m_pages.insert(
+			m_pages.end(),
+			std::make_move_iterator(other.m_pages.begin() + usedPageCount),
+			std::make_move_iterator(other.m_pages.end()));
+		m_current_page = insertPosition + other.m_current_page;
+		m_current_page_used = other.m_current_page_used;
+	}
+
+	// コンポーネントの所有権は移ったので、破棄せずに空にする
+	other.m_commands.clear();
+	other.m_values.clear();
+	other.m_pages.clear();
+	other.m_current_page = 0;
+	other.m_current_page_used = 0;
+}
+
+void* CommandBuffer::m_allocate(size_t size, size_t alignment) {
+	if (alignment > m_page_alignment) {
+		throw Exceptions::InvalidOperation("The component alignment is larger than the page alignment.");
+	}
+
+	// 残りのページに収まらなければ次のページへ進み、足りなければ確保する
+	while (m_current_page < m_pages.size()) {
+		const size_t offset = AlignUp(m_current_page_used, alignment);
+		if (offset + size <= m_pages[m_current_page].size) {
+			m_current_page_used = offset + size;
+			return m_pages[m_current_page].data.get() + offset;
+		}
+
+		++m_current_page;
+		m_current_page_used = 0;
+	}
+
+	const size_t pageSize = std::max(m_page_bytes, AlignUp(size, m_page_alignment));
+	Page page = { std::unique_ptr<std::byte, PageDeleter>(static_cast<std::byte*>(::operator new(pageSize, std::align_val_t{ m_page_alignment }))), pageSize };
+	m_pages.emplace_back(std::move(page));
+	m_current_page = m_pages.size() - 1;
+	m_current_page_used = size;
+	return m_pages.back().data.get();
+}
+
+void CommandBuffer::m_rollback(size_t valueCount) noexcept {
+	for (size_t i = valueCount; i < m_values.size(); ++i) {
+		if (m_values[i].data) {
+			m_values[i].info->destroy(m_values[i].data, 1);
+		}
+	}
+	m_values.resize(valueCount);
+}
@@ -0,0 +1,148 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "entity.hpp"
+#include "component.hpp"
+#include "../exceptions/invalid_argument.hpp"
+
+namespace PameECS::ECS {
+	// エンティティの作成、破棄とコンポーネントの追加、削除を記録しておき、World::ApplyCommandsでまとめて再生する
+	// ロックは取らないので、同時に記録するスレッド毎に別のバッファを使い、Spliceで1つにまとめること
+	// BasicQuery::ParallelEachでは、コマンドバッファを受け取るオーバーロードがブロック毎のバッファを用意する
+	// コンポーネントは記録した時点でバッファ内に構築され、再生時にチャンクへムーブされる
+	class CommandBuffer {
+	public:
+		CommandBuffer() = default;
+		~CommandBuffer() {
+			Clear();
+		}
+		CommandBuffer(const CommandBuffer&) = delete;
+		CommandBuffer& operator=(const CommandBuffer&) = delete;
+		CommandBuffer(CommandBuffer&&) noexcept = default;
+		CommandBuffer& operator=(CommandBuffer&&) = delete;
+
+		// 作成したエンティティは再生するまで分からないので、返さない
+		template<typename... Ts>
+			requires (sizeof...(Ts) > 0 && (Component<std::remove_cvref_t<Ts>> && ...))
+		void CreateEntity(Ts&&... components);
+		// 再生時に生きていないエンティティへのコマンドは無視される
+		void DestroyEntity(Entity entity) {
+			m_commands.push_back({ CommandType::DestroyEntity, entity, static_cast<uint32_t>(m_values.size()), 0, 0 });
+		}
+		// 既に持っていれば置き換える
+		template<Component T, typename... Args>
+		void AddComponent(Entity entity, Args&&... args);
+		template<Component T>
+		void RemoveComponent(Entity entity) {
+			m_commands.push_back({ CommandType::RemoveComponent, entity, static_cast<uint32_t>(m_values.size()), 0, GetComponentTypeId<T>() });
+		}
+
+		bool IsEmpty() const noexcept {
+			return m_commands.empty();
+		}
+		// 再生していないコマンドを捨てて記録したコンポーネントを破棄する、確保した領域は次の記録で使い回す
+		void Clear() noexcept;
+		// otherのコマンドを記録した順番のまま末尾に移し、otherを空にする
+		// コンポーネントはページごと引き取るので、ムーブし直さない
+		void Splice(CommandBuffer& other);
+	private:
+		friend class World;
+
+		enum class CommandType : uint8_t {
+			CreateEntity,
+			DestroyEntity,
+			AddComponent,
+			RemoveComponent,
+		};
+
+		struct Command {
+			CommandType type;
+			Entity entity; // CreateEntityでは使わない
+			uint32_t firstValue; // m_valuesの中の範囲
+			uint32_t valueCount;
+			ComponentTypeId componentId; // RemoveComponentでのみ使う
+		};
+
+		struct Value {
+			const ComponentInfo* info;
+			void* data; // ムーブか破棄をしたらnullptr
+		};
+
+		// 値の領域はページ単位で確保し、ページは移動しないので構築したコンポーネントのアドレスは変わらない
+		inline static constexpr size_t m_page_bytes = 16 * 1024;
+		inline static constexpr size_t m_page_alignment = 64;
+
+		struct PageDeleter {
+			void operator()(std::byte* data) const noexcept {
+				::operator delete(data, std::align_val_t{ m_page_alignment });
+			}
+		};
+		struct Page {
+			std::unique_ptr<std::byte, PageDeleter> data;
+			size_t size;
+		};
+
+		void* m_allocate(size_t size, size_t alignment);
+		// m_valuesの末尾に構築する
+		template<Component T, typename... Args>
+		void m_pushValue(Args&&... args);
+		// m_valuesをvalueCount個に戻し、それより後に構築したものを破棄する
+		void m_rollback(size_t valueCount) noexcept;
+
+		std::vector<Command> m_commands;
+		std::vector<Value> m_values;
+		std::vector<Page> m_pages;
+		size_t m_current_page = 0;
+		size_t m_current_page_used = 0;
+	};
+
+	template<typename... Ts>
+		requires (sizeof...(Ts) > 0 && (Component<std::remove_cvref_t<Ts>> && ...))
+	void CommandBuffer::CreateEntity(Ts&&... components) {
+		std::array<ComponentTypeId, sizeof...(Ts)> ids = { GetComponentTypeId<std::remove_cvref_t<Ts>>()... };
+		std::sort(ids.begin(), ids.end());
+		if (std::adjacent_find(ids.begin(), ids.end()) != ids.end()) {
+			throw Exceptions::InvalidArgument("The same component type is specified more than once.");
+		}
+
+		const size_t valueCount = m_values.size();
+		try {
+			(m_pushValue<std::remove_cvref_t<Ts>>(std::forward<Ts>(components)), ...);
+			m_commands.push_back({ CommandType::CreateEntity, {}, static_cast<uint32_t>(valueCount), static_cast<uint32_t>(sizeof...(Ts)), 0 });
+		}
+		catch (...) {
+			m_rollback(valueCount);
+			throw;
+		}
+	}
+
+	template<Component T, typename... Args>
+	void CommandBuffer::AddComponent(Entity entity, Args&&... args) {
+		const size_t valueCount = m_values.size();
+		try {
+			m_pushValue<T>(std::forward<Args>(args)...);
+			m_commands.push_back({ CommandType::AddComponent, entity, static_cast<uint32_t>(valueCount), 1, GetComponentTypeId<T>() });
+		}
+		catch (...) {
+			m_rollback(valueCount);
+			throw;
+		}
+	}
+
+	template<Component T, typename... Args>
+	void CommandBuffer::m_pushValue(Args&&... args) {
+		// 構築に失敗した時にm_rollbackで破棄しないように、構築が終わるまでdataはnullptrにしておく
+		m_values.push_back({ &GetComponentInfo<T>(), nullptr });
+		void* data = m_allocate(sizeof(T), alignof(T));
+		std::construct_at(static_cast<T*>(data), std::forward<Args>(args)...);
+		m_values.back().data = data;
+	}
+}
@@ -0,0 +1,9 @@
+#include "component.hpp"
+
+namespace {
+	PameECS::ECS::Internal::ComponentTypeIdGenerator componentTypeIdGenerator;
+}
+
+PameECS::ECS::Internal::ComponentTypeIdGenerator& PameECS::ECS::Internal::GetComponentTypeIdGenerator() noexcept {
+	return componentTypeIdGenerator;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+
+#include "../helpers/id_generator.hpp"
+
+namespace PameECS::ECS {
+	using ComponentTypeId = uint32_t;
+
+	// アーキタイプのチャンク内でムーブされるので、例外を投げずにムーブと破棄ができること
+	template<typename T>
+	concept Component =
+		std::is_object_v<T>
+		&& std::same_as<T, std::remove_cvref_t<T>>
+		&& std::is_nothrow_move_constructible_v<T>
+		&& std::is_nothrow_destructible_v<T>;
+
+	// 型を消したコンポーネントの情報、アーキタイプはこれだけでチャンク内のデータを扱う
+	struct ComponentInfo {
+		ComponentTypeId id;
+		size_t size;
+		size_t alignment;
+		// trueであれば、ムーブと破棄をmemcpyと何もしないことで代用できる
+		bool isTriviallyRelocatable;
+		// srcのcount個をdestにムーブ構築してから、srcを破棄する、領域は重ならないこと
+		void (*relocate)(void* dest, void* src, size_t count) noexcept;
+		void (*destroy)(void* data, size_t count) noexcept;
+		const char* name; // デバッグ用
+	};
+
+	namespace Internal {
+		using ComponentTypeIdGenerator = Helpers::IdGenerator<true, false, ComponentInfo, 0>;
+		// 生成器はcomponent.cppの匿名名前空間に1つだけ置き、全てのコンパイル単位がこれを通して同じ生成器を使う
+		ComponentTypeIdGenerator& GetComponentTypeIdGenerator() noexcept;
+
+		template<Component T>
+		void Relocate(void* dest, void* src, size_t count) noexcept {
+			if constexpr (std::is_trivially_copyable_v<T>) {
+				std::memcpy(dest, src, count * sizeof(T));
+			}
+			else {
+				T* destElements = static_cast<T*>(dest);
+				T* srcElements = static_cast<T*>(src);
+				for (size_t i = 0; i < count; ++i) {
+					std::construct_at(destElements + i, std::move(srcElements[i]));
+					std::destroy_at(srcElements + i);
+				}
+			}
+		}
+
+		template<Component T>
+		void Destroy(void* data, size_t count) noexcept {
+			if constexpr (!std::is_trivially_destructible_v<T>) {
+				std::destroy_n(static_cast<T*>(data), count);
+			}
+		}
+	}
+
+	// IdGeneratorのシンボルは全て同じにして、型毎に別のIDになるようにUnique1に型を渡す
+	template<Component T>
+	ComponentTypeId GetComponentTypeId() {
+		static const ComponentTypeId id = static_cast<ComponentTypeId>(
+			Internal::GetComponentTypeIdGenerator().GetId<"Component", T>());
+		return id;
+	}
+
+	template<Component T>
+	const ComponentInfo& GetComponentInfo() {
+		static const ComponentInfo info = {
+			GetComponentTypeId<T>(),
+			sizeof(T),
+			alignof(T),
+			std::is_trivially_copyable_v<T>,
+			&Internal::Relocate<T>,
+			&Internal::Destroy<T>,
+			typeid(T).name(),
+		};
+		return info;
+	}
+}
@@ -0,0 +1,14 @@
+#include "ecs_host.hpp"
+
+using PameECS::ECS::ECSHost;
+
+ECSHost::ECSHost(std::shared_ptr<BS::thread_pool<0U>> threadPool)
+	: m_scheduler(std::move(threadPool)) {}
+
+void ECSHost::Update() {
+	m_scheduler.Run(m_world);
+}
+
+void ECSHost::SubmitRenderTask() {
+	// 描画するコンポーネントがまだないので何もしない
+}
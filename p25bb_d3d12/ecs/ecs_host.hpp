@@ -0,0 +1,31 @@
+#pragma once
+#include <memory>
+#include <BS_thread_pool.hpp/BS_thread_pool.hpp>
+
+#include "world.hpp"
+#include "system_interface.hpp"
+#include "system_scheduler.hpp"
+
+namespace PameECS::ECS {
+	// ワールドとシステムを持ち、毎フレームシステムを実行する
+	// スレッドセーフではない
+	class ECSHost {
+	public:
+		explicit ECSHost(std::shared_ptr<BS::thread_pool<0U>> threadPool);
+		ECSHost(const ECSHost&) = delete;
+		ECSHost& operator=(const ECSHost&) = delete;
+
+		void Update();
+		void SubmitRenderTask();
+
+		void AddSystem(std::shared_ptr<ISystem> system) {
+			m_scheduler.AddSystem(std::move(system));
+		}
+		World& GetWorld() noexcept {
+			return m_world;
+		}
+	private:
+		World m_world;
+		SystemScheduler m_scheduler;
+	};
+}
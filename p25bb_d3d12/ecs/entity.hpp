@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+
+namespace PameECS::ECS {
+	// エンティティのハンドル、破棄されたエンティティのインデックスは世代を進めて再利用する
+	struct Entity {
+		static constexpr uint32_t invalidIndex = std::numeric_limits<uint32_t>::max();
+
+		uint32_t index = invalidIndex;
+		uint32_t generation = 0;
+
+		bool IsValid() const noexcept {
+			return index != invalidIndex;
+		}
+
+		friend bool operator==(const Entity&, const Entity&) = default;
+	};
+}
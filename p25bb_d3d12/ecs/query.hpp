@@ -0,0 +1,387 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <BS_thread_pool.hpp/BS_thread_pool.hpp>
+
+#include "entity.hpp"
+#include "component.hpp"
+#include "archetype.hpp"
+#include "command_buffer.hpp"
+#include "world.hpp"
+
+namespace PameECS::ECS {
+	// Queryの条件、constを付けた型は読み込み専用として渡される
+	template<typename... Ts>
+	struct With {};
+	template<typename... Ts>
+	struct Without {};
+	// 持っていなければnullptrが渡される
+	template<typename... Ts>
+	struct Optional {};
+
+	namespace Internal {
+		template<typename... Ts>
+		struct TypeList {};
+
+		template<typename... Lists>
+		struct ConcatTypeLists {
+			using Type = TypeList<>;
+		};
+		template<typename... Ts>
+		struct ConcatTypeLists<TypeList<Ts...>> {
+			using Type = TypeList<Ts...>;
+		};
+		template<typename... Ts, typename... Us, typename... Rest>
+		struct ConcatTypeLists<TypeList<Ts...>, TypeList<Us...>, Rest...> {
+			using Type = typename ConcatTypeLists<TypeList<Ts..., Us...>, Rest...>::Type;
+		};
+
+		template<typename Filter>
+		struct QueryFilterTraits {
+			static_assert(sizeof(Filter) == 0, "Query filters must be With, Without or Optional.");
+		};
+		template<typename... Ts>
+		struct QueryFilterTraits<With<Ts...>> {
+			using WithTypes = TypeList<Ts...>;
+			using WithoutTypes = TypeList<>;
+			using OptionalTypes = TypeList<>;
+		};
+		template<typename... Ts>
+		struct QueryFilterTraits<Without<Ts...>> {
+			using WithTypes = TypeList<>;
+			using WithoutTypes = TypeList<Ts...>;
+			using OptionalTypes = TypeList<>;
+		};
+		template<typename... Ts>
+		struct QueryFilterTraits<Optional<Ts...>> {
+			using WithTypes = TypeList<>;
+			using WithoutTypes = TypeList<>;
+			using OptionalTypes = TypeList<Ts...>;
+		};
+	}
+
+	template<typename WithList, typename WithoutList, typename OptionalList>
+	class BasicQuery;
+
+	// 条件に一致するアーキタイプの一覧を持ち、ワールドに新しく作られたアーキタイプだけを調べて追加する
+	// アーキタイプは削除されず列の位置も変わらないので、一度一致したものは調べ直さない
+	// 反復中にワールドの構成を変えてはいけない、ワールドはクエリより長生きすること
+	template<typename... Ws, typename... Xs, typename... Os>
+	class BasicQuery<Internal::TypeList<Ws...>, Internal::TypeList<Xs...>, Internal::TypeList<Os...>> {
+		static_assert((Component<std::remove_const_t<Ws>> && ...), "With types must be components.");
+		static_assert((Component<std::remove_const_t<Xs>> && ...), "Without types must be components.");
+		static_assert((Component<std::remove_const_t<Os>> && ...), "Optional types must be components.");
+	public:
+		// ParallelEachでこれより少ない数のエンティティしかなければ、スレッドプールを使わない
+		inline static constexpr size_t defaultMinBatchSize = 1024;
+
+		struct Match {
+			Archetype* archetype;
+			std::array<size_t, sizeof...(Ws)> withColumns;
+			std::array<size_t, sizeof...(Os)> optionalColumns; // 持っていなければArchetype::npos
+		};
+
+		explicit BasicQuery(World& world)
+			: m_world(world),
+			m_with_ids{ GetComponentTypeId<std::remove_const_t<Ws>>()... },
+			m_without_ids{ GetComponentTypeId<std::remove_const_t<Xs>>()... },
+			m_optional_ids{ GetComponentTypeId<std::remove_const_t<Os>>()... } {
+			Update();
+		}
+
+		// 前回から増えたアーキタイプだけを調べる、EachとEachChunkは自動で呼ぶ
+		void Update() {
+			const auto archetypes = m_world.GetArchetypes();
+			for (; m_checked_archetype_count < archetypes.size(); ++m_checked_archetype_count) {
+				m_tryMatch(*archetypes[m_checked_archetype_count]);
+			}
+		}
+
+		std::span<const Match> GetMatches() const noexcept {
+			return m_matches;
+		}
+		size_t GetEntityCount() {
+			Update();
+			size_t count = 0;
+			for (const auto& match : m_matches) {
+				count += match.archetype->GetEntityCount();
+			}
+			return count;
+		}
+
+		// fn(uint32_t count, const Entity* entities, Ws* ..., Os* ...)をチャンク毎に呼ぶ、Optionalの列がなければnullptr
+		template<typename F>
+		void EachChunk(F&& fn) {
+			Update();
+			for (const auto& match : m_matches) {
+				const Archetype& archetype = *match.archetype;
+				for (size_t chunkIndex = 0; chunkIndex < archetype.GetChunkCount(); ++chunkIndex) {
+					m_invokeChunk(fn, match, chunkIndex, 0, archetype.GetChunkEntityCount(chunkIndex));
+				}
+			}
+		}
+
+		// fn(Ws& ..., Os* ...)かfn(Entity, Ws& ..., Os* ...)をエンティティ毎に呼ぶ
+		template<typename F>
+		void Each(F&& fn) {
+			EachChunk(m_makeRowInvoker(fn));
+		}
+
+		// 一致したエンティティを、数がほぼ等しい連続した範囲(ブロック)に分けて並列に実行し、全て終わるまで待つ
+		// 範囲はチャンクの途中で区切られることがあり、fnはチャンクの一部に対して呼ばれる
+		// fnは複数のスレッドから同時に呼ばれる、例外が発生した場合はまだ始まっていないブロックを実行せず、実行中のブロックが終わってから最初の例外を投げ直す
+		// minBatchSize未満のブロックは作らず、エンティティが少なければ呼び出し元のスレッドで実行する
+		// 呼び出し元のスレッドもブロックを取って実行し、待つのは他のスレッドが実行中のブロックだけなので、threadPoolのワーカーから呼んでもデッドロックしない
+		template<typename F>
+		void ParallelEachChunk(BS::thread_pool<0U>& threadPool, F&& fn, size_t minBatchSize = defaultMinBatchSize) {
+			// fnから同じクエリを使えるように、チャンクの表は呼び出し毎に作る
+			std::vector<ParallelChunk> chunks;
+			const size_t entityCount = m_collectParallelChunks(chunks);
+			const size_t blockCount = m_getParallelBlockCount(threadPool, entityCount, minBatchSize);
+			if (blockCount <= 1) {
+				m_invokeRange(fn, chunks, 0, entityCount);
+				return;
+			}
+
+			auto runBlock = [this, &fn, &chunks, entityCount, blockCount](size_t block) {
+				m_invokeRange(fn, chunks, block * entityCount / blockCount, (block + 1) * entityCount / blockCount);
+			};
+			m_runBlocks(threadPool, blockCount, runBlock);
+		}
+
+		// fn(CommandBuffer& commands, uint32_t count, const Entity* entities, Ws* ..., Os* ...)を並列に呼ぶ
+		// commandsはブロック毎に別のバッファで、同時に記録してもよい、全て終わってからブロックの順番にcommandsの末尾へ移すので結果は実行順に依らない
+		// 例外を投げた場合、commandsに途中までのコマンドが残ることがある
+		template<typename F>
+		void ParallelEachChunk(BS::thread_pool<0U>& threadPool, CommandBuffer& commands, F&& fn, size_t minBatchSize = defaultMinBatchSize) {
+			std::vector<ParallelChunk> chunks;
+			const size_t entityCount = m_collectParallelChunks(chunks);
+			const size_t blockCount = m_getParallelBlockCount(threadPool, entityCount, minBatchSize);
+			if (blockCount <= 1) {
+				auto invoker = m_makeCommandInvoker(fn, commands);
+				m_invokeRange(invoker, chunks, 0, entityCount);
+				return;
+			}
+
+			// 最初のブロックはcommandsに直接記録する
+			std::vector<CommandBuffer> blockCommands(blockCount - 1);
+			auto runBlock = [this, &fn, &commands, &blockCommands, &chunks, entityCount, blockCount](size_t block) {
+				auto invoker = m_makeCommandInvoker(fn, block == 0 ? commands : blockCommands[block - 1]);
+				m_invokeRange(invoker, chunks, block * entityCount / blockCount, (block + 1) * entityCount / blockCount);
+			};
+			m_runBlocks(threadPool, blockCount, runBlock);
+
+			for (auto& blockCommand : blockCommands) {
+				commands.Splice(blockCommand);
+			}
+		}
+
+		// Eachと同じfnを、ParallelEachChunkと同じ分け方で並列に呼ぶ
+		template<typename F>
+		void ParallelEach(BS::thread_pool<0U>& threadPool, F&& fn, size_t minBatchSize = defaultMinBatchSize) {
+			ParallelEachChunk(threadPool, m_makeRowInvoker(fn), minBatchSize);
+		}
+
+		// fn(CommandBuffer& commands, Ws& ..., Os* ...)かfn(CommandBuffer& commands, Entity, Ws& ..., Os* ...)を並列に呼ぶ
+		// commandsの扱いはParallelEachChunkと同じ
+		template<typename F>
+		void ParallelEach(BS::thread_pool<0U>& threadPool, CommandBuffer& commands, F&& fn, size_t minBatchSize = defaultMinBatchSize) {
+			ParallelEachChunk(threadPool, commands, m_makeCommandRowInvoker(fn), minBatchSize);
+		}
+	private:
+		void m_tryMatch(Archetype& archetype) {
+			for (ComponentTypeId id : m_with_ids) {
+				if (!archetype.HasComponent(id)) {
+					return;
+				}
+			}
+			for (ComponentTypeId id : m_without_ids) {
+				if (archetype.HasComponent(id)) {
+					return;
+				}
+			}
+
+			Match match = { &archetype, {}, {} };
+			for (size_t i = 0; i < m_with_ids.size(); ++i) {
+				match.withColumns[i] = archetype.FindColumn(m_with_ids[i]);
+			}
+			for (size_t i = 0; i < m_optional_ids.size(); ++i) {
+				match.optionalColumns[i] = archetype.FindColumn(m_optional_ids[i]);
+			}
+			m_matches.emplace_back(match);
+		}
+
+		template<typename F>
+		static auto m_makeRowInvoker(F& fn) {
+			return [&fn](uint32_t count, const Entity* entities, Ws*... withs, Os*... optionals) {
+				for (uint32_t i = 0; i < count; ++i) {
+					if constexpr (std::is_invocable_v<F&, Entity, Ws&..., Os*...>) {
+						fn(entities[i], withs[i]..., (optionals ? optionals + i : nullptr)...);
+					}
+					else {
+						fn(withs[i]..., (optionals ? optionals + i : nullptr)...);
+					}
+				}
+			};
+		}
+
+		template<typename F>
+		static auto m_makeCommandRowInvoker(F& fn) {
+			return [&fn](CommandBuffer& commands, uint32_t count, const Entity* entities, Ws*... withs, Os*... optionals) {
+				for (uint32_t i = 0; i < count; ++i) {
+					if constexpr (std::is_invocable_v<F&, CommandBuffer&, Entity, Ws&..., Os*...>) {
+						fn(commands, entities[i], withs[i]..., (optionals ? optionals + i : nullptr)...);
+					}
+					else {
+						fn(commands, withs[i]..., (optionals ? optionals + i : nullptr)...);
+					}
+				}
+			};
+		}
+
+		// 先頭にcommandsを付けてfnを呼ぶ、m_invokeChunkに渡す
+		template<typename F>
+		static auto m_makeCommandInvoker(F& fn, CommandBuffer& commands) {
+			return [&fn, &commands](uint32_t count, const Entity* entities, Ws*... withs, Os*... optionals) {
+				fn(commands, count, entities, withs..., optionals...);
+			};
+		}
+
+		// チャンクのfirstRowからcount個に対してfnを呼ぶ
+		template<typename F>
+		static void m_invokeChunk(F& fn, const Match& match, size_t chunkIndex, uint32_t firstRow, uint32_t count) {
+			m_invokeChunk(fn, match, chunkIndex, firstRow, count, std::index_sequence_for<Ws...>{}, std::index_sequence_for<Os...>{});
+		}
+		template<typename F, size_t... WithIndexes, size_t... OptionalIndexes>
+		static void m_invokeChunk(F& fn, const Match& match, size_t chunkIndex, uint32_t firstRow, uint32_t count, std::index_sequence<WithIndexes...>, std::index_sequence<OptionalIndexes...>) {
+			const Archetype& archetype = *match.archetype;
+			fn(
+				count,
+				archetype.GetEntities(chunkIndex) + firstRow,
+				static_cast<Ws*>(archetype.GetColumnData(chunkIndex, match.withColumns[WithIndexes])) + firstRow...,
+				(match.optionalColumns[OptionalIndexes] != Archetype::npos
+					? static_cast<Os*>(archetype.GetColumnData(chunkIndex, match.optionalColumns[OptionalIndexes])) + firstRow
+					: nullptr)...);
+		}
+
+		struct ParallelChunk {
+			const Match* match;
+			size_t chunkIndex;
+			size_t firstIndex; // 一致した全てのエンティティの中での通し番号
+			uint32_t count;
+		};
+
+		// 一致した全てのチャンクをchunksに並べ、エンティティの数を返す
+		size_t m_collectParallelChunks(std::vector<ParallelChunk>& chunks) {
+			Update();
+			size_t entityCount = 0;
+			for (const auto& match : m_matches) {
+				const Archetype& archetype = *match.archetype;
+				for (size_t chunkIndex = 0; chunkIndex < archetype.GetChunkCount(); ++chunkIndex) {
+					const uint32_t count = archetype.GetChunkEntityCount(chunkIndex);
+					chunks.emplace_back(ParallelChunk{ &match, chunkIndex, entityCount, count });
+					entityCount += count;
+				}
+			}
+			return entityCount;
+		}
+
+		static size_t m_getParallelBlockCount(const BS::thread_pool<0U>& threadPool, size_t entityCount, size_t minBatchSize) {
+			return std::min<size_t>(threadPool.get_thread_count(), entityCount / std::max<size_t>(1, minBatchSize));
+		}
+
+		// m_runBlocksの状態、呼び出し元が戻った後に始まるヘルパーのタスクも触れるので共有して持つ
+		struct ParallelBlocks {
+			size_t blockCount = 0;
+			std::atomic<size_t> nextBlock = 0;
+			std::atomic<size_t> finishedBlocks = 0;
+			std::atomic<bool> hasFailed = false;
+			std::exception_ptr exception = nullptr; // hasFailedを最初に立てたスレッドだけが書き込む
+		};
+
+		// runBlock(block)を[0, blockCount)の各ブロックに対して、ヘルパーのタスクと呼び出し元のスレッドで取り合って呼ぶ
+		template<typename F>
+		static void m_runBlocks(BS::thread_pool<0U>& threadPool, size_t blockCount, F& runBlock) {
+			auto state = std::make_shared<ParallelBlocks>();
+			state->blockCount = blockCount;
+			try {
+				for (size_t i = 1; i < blockCount; ++i) {
+					// ブロックを取れなかったヘルパーはrunBlockに触れないので、呼び出し元が戻った後に始まってもよい
+					threadPool.detach_task([state, &runBlock] {
+						m_claimBlocks(*state, runBlock);
+					});
+				}
+			}
+			catch (...) {
+				// 投入できなかったヘルパーの分は、呼び出し元のスレッドが実行する
+			}
+			m_claimBlocks(*state, runBlock);
+
+			// 残っているのは他のスレッドが取ったブロックだけなので、その終わりを待つ
+			for (size_t finished = state->finishedBlocks.load(std::memory_order_acquire); finished < blockCount; finished = state->finishedBlocks.load(std::memory_order_acquire)) {
+				state->finishedBlocks.wait(finished, std::memory_order_acquire);
+			}
+			if (state->hasFailed.load(std::memory_order_relaxed)) {
+				std::rethrow_exception(state->exception);
+			}
+		}
+		template<typename F>
+		static void m_claimBlocks(ParallelBlocks& state, F& runBlock) noexcept {
+			for (size_t block = state.nextBlock.fetch_add(1, std::memory_order_relaxed); block < state.blockCount; block = state.nextBlock.fetch_add(1, std::memory_order_relaxed)) {
+				if (!state.hasFailed.load(std::memory_order_relaxed)) {
+					try {
+						runBlock(block);
+					}
+					catch (...) {
+						if (!state.hasFailed.exchange(true, std::memory_order_relaxed)) {
+							state.exception = std::current_exception();
+						}
+					}
+				}
+				if (state.finishedBlocks.fetch_add(1, std::memory_order_acq_rel) + 1 == state.blockCount) {
+					state.finishedBlocks.notify_all();
+				}
+			}
+		}
+
+		// chunksを通し番号で見た[start, end)のエンティティに対してfnを呼ぶ
+		template<typename F>
+		void m_invokeRange(F& fn, std::span<const ParallelChunk> chunks, size_t start, size_t end) const {
+			if (start >= end) {
+				return;
+			}
+
+			auto it = std::upper_bound(chunks.begin(), chunks.end(), start, [](size_t index, const ParallelChunk& chunk) {
+				return index < chunk.firstIndex;
+			});
+			for (--it; start < end; ++it) {
+				const uint32_t firstRow = static_cast<uint32_t>(start - it->firstIndex);
+				const uint32_t count = static_cast<uint32_t>(std::min<size_t>(it->count - firstRow, end - start));
+				m_invokeChunk(fn, *it->match, it->chunkIndex, firstRow, count);
+				start += count;
+			}
+		}
+
+		World& m_world;
+		std::array<ComponentTypeId, sizeof...(Ws)> m_with_ids;
+		std::array<ComponentTypeId, sizeof...(Xs)> m_without_ids;
+		std::array<ComponentTypeId, sizeof...(Os)> m_optional_ids;
+		std::vector<Match> m_matches;
+		size_t m_checked_archetype_count = 0;
+	};
+
+	// Query<With<A, const B>, Without<C>, Optional<D>>のように、条件を順不同で並べる
+	template<typename... Filters>
+	using Query = BasicQuery<
+		typename Internal::ConcatTypeLists<typename Internal::QueryFilterTraits<Filters>::WithTypes...>::Type,
+		typename Internal::ConcatTypeLists<typename Internal::QueryFilterTraits<Filters>::WithoutTypes...>::Type,
+		typename Internal::ConcatTypeLists<typename Internal::QueryFilterTraits<Filters>::OptionalTypes...>::Type>;
+}
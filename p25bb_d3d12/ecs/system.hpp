@@ -0,0 +1,70 @@
+#pragma once
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+#include "component.hpp"
+#include "system_interface.hpp"
+
+namespace PameECS::ECS {
+	// Systemのテンプレート引数でアクセスを宣言する
+	template<Component... Ts>
+	struct Read {};
+	template<Component... Ts>
+	struct Write {};
+	// ワールドの構成を変えるなど、他のシステムと同時に実行できない
+	struct Exclusive {};
+
+	namespace Internal {
+		template<typename Access>
+		struct SystemAccessTraits {
+			static_assert(sizeof(Access) == 0, "System accesses must be Read, Write or Exclusive.");
+		};
+		template<Component... Ts>
+		struct SystemAccessTraits<Read<Ts...>> {
+			static void Append(SystemAccess& access) {
+				(access.reads.emplace_back(GetComponentTypeId<Ts>()), ...);
+			}
+		};
+		template<Component... Ts>
+		struct SystemAccessTraits<Write<Ts...>> {
+			static void Append(SystemAccess& access) {
+				(access.writes.emplace_back(GetComponentTypeId<Ts>()), ...);
+			}
+		};
+		template<>
+		struct SystemAccessTraits<Exclusive> {
+			static void Append(SystemAccess& access) {
+				access.isExclusive = true;
+			}
+		};
+
+		template<typename... Accesses>
+		SystemAccess MakeSystemAccess() {
+			SystemAccess access;
+			(SystemAccessTraits<Accesses>::Append(access), ...);
+
+			auto normalize = [](std::vector<ComponentTypeId>& ids) {
+				std::sort(ids.begin(), ids.end());
+				ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+			};
+			normalize(access.reads);
+			normalize(access.writes);
+			// 読み書きする場合は書き込みだけに入れる
+			std::erase_if(access.reads, [&](ComponentTypeId id) {
+				return std::binary_search(access.writes.begin(), access.writes.end(), id);
+			});
+			return access;
+		}
+	}
+
+	// class MoveSystem : public System<Read<Velocity>, Write<Position>> のように継承して、Updateを実装する
+	template<typename... Accesses>
+	class System : public ISystem {
+	public:
+		const SystemAccess& GetAccess() const override {
+			static const SystemAccess access = Internal::MakeSystemAccess<Accesses...>();
+			return access;
+		}
+	};
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+
+#include "component.hpp"
+
+namespace PameECS::ECS {
+	class World;
+	class CommandBuffer;
+
+	// システムが触れるコンポーネント、IDの昇順で重複がない
+	struct SystemAccess {
+		std::vector<ComponentTypeId> reads; // 書き込むものは含まない
+		std::vector<ComponentTypeId> writes;
+		bool isExclusive = false; // trueであれば、他の全てのシステムと同時に実行しない
+
+		// どちらかが書き込むコンポーネントを、もう一方が読み書きするか
+		bool ConflictsWith(const SystemAccess& other) const {
+			if (isExclusive || other.isExclusive) {
+				return true;
+			}
+
+			auto intersects = [](const std::vector<ComponentTypeId>& a, const std::vector<ComponentTypeId>& b) {
+				auto itA = a.begin();
+				auto itB = b.begin();
+				while (itA != a.end() && itB != b.end()) {
+					if (*itA == *itB) {
+						return true;
+					}
+					*itA < *itB ? ++itA : ++itB;
+				}
+				return false;
+			};
+			return intersects(writes, other.reads)
+				|| intersects(writes, other.writes)
+				|| intersects(reads, other.writes);
+		}
+	};
+
+	// Updateは、アクセスが衝突しない他のシステムと同時に別のスレッドで呼ばれる
+	// GetAccessで宣言していないコンポーネントに触れてはいけない
+	// ワールドの構成は直接変えずにcommandsに記録する、commandsはこのシステム専用で、SystemScheduler::Runの最後に再生される
+	// commandsはロックを取らないので、ParallelEachなどで複数のスレッドから記録する場合はcommandsを受け取るオーバーロードでブロック毎のバッファに記録する
+	class ISystem {
+	public:
+		virtual ~ISystem() = default;
+		virtual const SystemAccess& GetAccess() const = 0;
+		virtual void Update(World& world, CommandBuffer& commands) = 0;
+	};
+}
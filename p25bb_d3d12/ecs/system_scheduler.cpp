@@ -0,0 +1,145 @@
+#include "system_scheduler.hpp"
+#include <cassert>
+#include "../exceptions/invalid_argument.hpp"
+
+using PameECS::ECS::SystemScheduler;
+
+SystemScheduler::SystemScheduler(std::shared_ptr<BS::thread_pool<0U>> threadPool)
+	: m_thread_pool(std::move(threadPool)) {
+	assert(m_thread_pool);
+}
+
+void SystemScheduler::AddSystem(std::shared_ptr<ISystem> system) {
+	if (!system) {
+		throw Exceptions::InvalidArgument("The system is null.");
+	}
+
+	m_command_buffers.emplace_back();
+	try {
+		m_systems.emplace_back(std::move(system));
+	}
+	catch (...) {
+		m_command_buffers.pop_back();
+		throw;
+	}
+	m_are_dependencies_dirty = true;
+}
+
+void SystemScheduler::Run(World& world) {
+	if (m_are_dependencies_dirty) {
+		m_buildDependencies();
+	}
+	if (m_systems.empty()) {
+		return;
+	}
+
+	for (size_t i = 0; i < m_systems.size(); ++i) {
+		m_remaining_predecessors[i].store(m_predecessors[i].size(), std::memory_order_relaxed);
+	}
+
+	RunState state = { world, std::latch(static_cast<std::ptrdiff_t>(m_systems.size())) };
+	for (size_t i = 0; i + 1 < m_roots.size(); ++i) {
+		m_submit(m_roots[i], state);
+	}
+	m_runSystem(m_roots.back(), state);
+	state.remainingSystems.wait();
+
+	if (state.hasFailed.load(std::memory_order_relaxed)) {
+		for (auto& commands : m_command_buffers) {
+			commands.Clear();
+		}
+		std::rethrow_exception(state.exception);
+	}
+
+	// システムは順不同で終わるが、再生はシステムを追加した順番で行うので結果は変わらない
+	m_pending_command_buffers.clear();
+	for (auto& commands : m_command_buffers) {
+		if (!commands.IsEmpty()) {
+			m_pending_command_buffers.emplace_back(&commands);
+		}
+	}
+	if (!m_pending_command_buffers.empty()) {
+		world.ApplyCommands(m_pending_command_buffers);
+	}
+}
+
+std::span<const size_t> SystemScheduler::GetPredecessors(size_t index) {
+	if (index >= m_systems.size()) {
+		throw Exceptions::InvalidArgument("The system index is out of range.");
+	}
+	if (m_are_dependencies_dirty) {
+		m_buildDependencies();
+	}
+
+	return m_predecessors[index];
+}
+
+void SystemScheduler::m_buildDependencies() {
+	std::vector<std::vector<size_t>> predecessors(m_systems.size());
+	std::vector<std::vector<size_t>> successors(m_systems.size());
+	std::vector<size_t> roots;
+	for (size_t i = 0; i < m_systems.size(); ++i) {
+		const SystemAccess& access = m_systems[i]->GetAccess();
+		for (size_t j = 0; j < i; ++j) {
+			if (access.ConflictsWith(m_systems[j]->GetAccess())) {
+				predecessors[i].emplace_back(j);
+				successors[j].emplace_back(i);
+			}
+		}
+		if (predecessors[i].empty()) {
+			roots.emplace_back(i);
+		}
+	}
+
+	m_remaining_predecessors = std::make_unique<std::atomic<size_t>[]>(m_systems.size());
+	m_predecessors = std::move(predecessors);
+	m_successors = std::move(successors);
+	m_roots = std::move(roots);
+	m_are_dependencies_dirty = false;
+}
+
+void SystemScheduler::m_runSystem(size_t index, RunState& state) noexcept {
+	// 実行できるようになった後続の最後の1つは同じスレッドで続けて実行し、スレッドプールへの投入を減らす
+	while (true) {
+		// 失敗した後に始まるシステムは実行しないが、後続を数え終えるために依存関係は辿る
+		if (!state.hasFailed.load(std::memory_order_relaxed)) {
+			try {
+				m_systems[index]->Update(state.world, m_command_buffers[index]);
+			}
+			catch (...) {
+				if (!state.hasFailed.exchange(true, std::memory_order_relaxed)) {
+					state.exception = std::current_exception();
+				}
+			}
+		}
+
+		// 待ち数はacq_relで減らし、先行する全てのシステムの書き込みを最後に減らしたスレッドから見えるようにする
+		size_t next = m_systems.size();
+		for (size_t successor : m_successors[index]) {
+			if (m_remaining_predecessors[successor].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				if (next != m_systems.size()) {
+					m_submit(next, state);
+				}
+				next = successor;
+			}
+		}
+
+		// 全てのシステムが数え終わるとRunが戻りstateは破棄されるので、これ以降は後続がある場合しかstateに触れない
+		state.remainingSystems.count_down();
+		if (next == m_systems.size()) {
+			return;
+		}
+		index = next;
+	}
+}
+
+void SystemScheduler::m_submit(size_t index, RunState& state) noexcept {
+	try {
+		m_thread_pool->detach_task([this, index, &state] {
+			m_runSystem(index, state);
+		});
+	}
+	catch (...) {
+		m_runSystem(index, state);
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <exception>
+#include <latch>
+#include <memory>
+#include <span>
+#include <vector>
+#include <BS_thread_pool.hpp/BS_thread_pool.hpp>
+
+#include "system_interface.hpp"
+#include "command_buffer.hpp"
+#include "world.hpp"
+
+namespace PameECS::ECS {
+	// 追加された順番を論理的な実行順とし、アクセスが衝突するシステム同士だけその順番を守る
+	// システムは、衝突する先に追加された全てのシステムが終わった時点でスレッドプールに投入され、それ以外の待ちは生じない
+	// 各システムが記録したコマンドは、Runの最後に全てのシステムが終わってからシステムを追加した順番で再生する
+	// スレッドセーフではない
+	class SystemScheduler {
+	public:
+		explicit SystemScheduler(std::shared_ptr<BS::thread_pool<0U>> threadPool);
+		SystemScheduler(const SystemScheduler&) = delete;
+		SystemScheduler& operator=(const SystemScheduler&) = delete;
+
+		void AddSystem(std::shared_ptr<ISystem> system);
+		// 全てのシステムを依存関係に従って実行し、最後のシステムが終わるまで待ってからコマンドを再生する
+		// システムが例外を投げた場合は、まだ始まっていないシステムを実行せず、実行中のシステムが終わってから全てのコマンドを捨てて最初の例外を投げ直す
+		void Run(World& world);
+
+		// indexのシステムより先に終わっている必要がある、アクセスが衝突するシステムのインデックス(昇順)
+		std::span<const size_t> GetPredecessors(size_t index);
+	private:
+		struct RunState {
+			World& world;
+			std::latch remainingSystems;
+			std::atomic<bool> hasFailed = false;
+			std::exception_ptr exception = nullptr; // hasFailedを最初に立てたスレッドだけが書き込む
+		};
+
+		void m_buildDependencies();
+		// indexのシステムを実行し、それで実行できるようになった後続のシステムを1つは同じスレッドで、残りはスレッドプールで実行する
+		void m_runSystem(size_t index, RunState& state) noexcept;
+		// スレッドプールに投入できなければ呼び出し元のスレッドで実行する
+		void m_submit(size_t index, RunState& state) noexcept;
+
+		std::shared_ptr<BS::thread_pool<0U>> m_thread_pool;
+		std::vector<std::shared_ptr<ISystem>> m_systems;
+		std::vector<CommandBuffer> m_command_buffers; // m_systemsと同じ順番
+		std::vector<CommandBuffer*> m_pending_command_buffers;
+		std::vector<std::vector<size_t>> m_predecessors;
+		std::vector<std::vector<size_t>> m_successors;
+		std::vector<size_t> m_roots; // 先行するシステムがないもの、システムがあれば必ず最初のシステムを含む
+		std::unique_ptr<std::atomic<size_t>[]> m_remaining_predecessors; // Run毎に先行するシステムの数で初期化する
+		bool m_are_dependencies_dirty = false;
+	};
+}
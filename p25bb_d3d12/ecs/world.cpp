@@ -0,0 +1,460 @@
+#include "world.hpp"
+#include <cassert>
+#include <limits>
+#include <tuple>
+#include "../exceptions/invalid_operation.hpp"
+
+using PameECS::ECS::World;
+
+World::World() {
+	m_empty_archetype = &m_getOrCreateArchetype({});
+}
+
+PameECS::ECS::Entity World::CreateEntity() {
+	const Entity entity = m_allocateEntity();
+	try {
+		auto& record = m_entity_records[entity.index];
+		record.row = m_empty_archetype->PushRow(entity);
+		record.archetype = m_empty_archetype;
+	}
+	catch (...) {
+		m_freeEntity(entity);
+		throw;
+	}
+
+	return entity;
+}
+
+void World::DestroyEntity(Entity entity) {
+	auto& record = m_getRecord(entity);
+	record.archetype->DestroyRow(record.row);
+	m_eraseRow(*record.archetype, record.row);
+	m_freeEntity(entity);
+}
+
+bool World::IsAlive(Entity entity) const noexcept {
+	return entity.index < m_entity_records.size()
+		&& m_entity_records[entity.index].archetype
+		&& m_entity_records[entity.index].generation == entity.generation;
+}
+
+const World::EntityRecord& World::m_getRecord(Entity entity) const {
+	if (!IsAlive(entity)) {
+		throw Exceptions::InvalidArgument("The entity is not alive.");
+	}
+
+	return m_entity_records[entity.index];
+}
+
+PameECS::ECS::Entity World::m_allocateEntity() {
+	uint32_t index = 0;
+	if (!m_free_indexes.empty()) {
+		index = m_free_indexes.back();
+		m_free_indexes.pop_back();
+	}
+	else {
+		if (m_entity_records.size() >= Entity::invalidIndex) {
+			throw Exceptions::InvalidOperation("Too many entities.");
+		}
+		index = static_cast<uint32_t>(m_entity_records.size());
+		m_entity_records.emplace_back();
+		// m_freeEntityで例外が投げられないように、全てのインデックスが入る容量を先に確保する
+		try {
+			m_free_indexes.reserve(m_entity_records.capacity());
+		}
+		catch (...) {
+			m_entity_records.pop_back();
+			throw;
+		}
+	}
+
+	++m_entity_count;
+	return { index, m_entity_records[index].generation };
+}
+
+void World::m_freeEntity(Entity entity) noexcept {
+	auto& record = m_entity_records[entity.index];
+	record.archetype = nullptr;
+	// 古いハンドルで同じインデックスの新しいエンティティに触れないように、世代を進める
+	++record.generation;
+
+	m_free_indexes.emplace_back(entity.index);
+	--m_entity_count;
+}
+
+PameECS::ECS::Archetype& World::m_getOrCreateArchetype(std::vector<const ComponentInfo*> components) {
+	std::vector<ComponentTypeId> signature;
+	signature.reserve(components.size());
+	for (const ComponentInfo* info : components) {
+		signature.emplace_back(info->id);
+	}
+
+	auto it = m_archetype_by_signature.find(signature);
+	if (it != m_archetype_by_signature.end()) {
+		return *it->second;
+	}
+
+	m_archetypes.emplace_back(std::make_unique<Archetype>(m_archetypes.size(), std::move(components)));
+	Archetype* archetype = m_archetypes.back().get();
+	try {
+		m_archetype_by_signature.emplace(std::move(signature), archetype);
+	}
+	catch (...) {
+		m_archetypes.pop_back();
+		throw;
+	}
+
+	return *archetype;
+}
+
+PameECS::ECS::Archetype& World::m_getArchetypeWith(Archetype& from, const ComponentInfo& component) {
+	if (Archetype* cached = from.GetAddEdge(component.id)) {
+		return *cached;
+	}
+
+	std::vector<const ComponentInfo*> components;
+	components.reserve(from.GetColumns().size() + 1);
+	for (const auto& column : from.GetColumns()) {
+		components.emplace_back(column.info);
+	}
+	components.insert(
+		std::upper_bound(components.begin(), components.end(), component.id, [](ComponentTypeId id, const ComponentInfo* info) {
+			return id < info->id;
+		}),
+		&component);
+
+	Archetype& to = m_getOrCreateArchetype(std::move(components));
+	from.SetAddEdge(component.id, &to);
+	to.SetRemoveEdge(component.id, &from);
+	return to;
+}
+
+PameECS::ECS::Archetype& World::m_getArchetypeWithout(Archetype& from, ComponentTypeId id) {
+	if (Archetype* cached = from.GetRemoveEdge(id)) {
+		return *cached;
+	}
+
+	std::vector<const ComponentInfo*> components;
+	components.reserve(from.GetColumns().size());
+	for (const auto& column : from.GetColumns()) {
+		if (column.info->id != id) {
+			components.emplace_back(column.info);
+		}
+	}
+
+	Archetype& to = m_getOrCreateArchetype(std::move(components));
+	from.SetRemoveEdge(id, &to);
+	to.SetAddEdge(id, &from);
+	return to;
+}
+
+void World::m_moveEntity(Entity entity, EntityRecord& record, Archetype& to) {
+	Archetype& from = *record.archetype;
+	const uint32_t fromRow = record.row;
+	// ここより後は例外を投げない
+	const uint32_t toRow = to.PushRow(entity);
+
+	const auto columns = from.GetColumns();
+	for (size_t fromColumn = 0; fromColumn < columns.size(); ++fromColumn) {
+		const ComponentInfo& info = *columns[fromColumn].info;
+		void* source = from.GetComponentData(fromRow, fromColumn);
+		const size_t toColumn = to.FindColumn(info.id);
+		if (toColumn != Archetype::npos) {
+			info.relocate(to.GetComponentData(toRow, toColumn), source, 1);
+		}
+		else {
+			info.destroy(source, 1);
+		}
+	}
+
+	m_eraseRow(from, fromRow);
+	record.archetype = &to;
+	record.row = toRow;
+}
+
+void World::m_eraseRow(Archetype& archetype, uint32_t row) noexcept {
+	const Entity moved = archetype.EraseRow(row);
+	if (moved.IsValid()) {
+		m_entity_records[moved.index].row = row;
+	}
+}
+
+void World::ApplyCommands(std::span<CommandBuffer* const> buffers) {
+	try {
+		m_foldCommands(buffers);
+		m_applyPendingChanges();
+	}
+	catch (...) {
+		for (CommandBuffer* buffer : buffers) {
+			buffer->Clear();
+		}
+		throw;
+	}
+
+	for (CommandBuffer* buffer : buffers) {
+		buffer->Clear();
+	}
+}
+
+void World::m_foldCommands(std::span<CommandBuffer* const> buffers) {
+	m_pending_changes.clear();
+	m_pending_values.clear();
+	m_pending_change_by_entity.clear();
+
+	std::vector<const ComponentInfo*> infos;
+	for (CommandBuffer* buffer : buffers) {
+		for (const auto& command : buffer->m_commands) {
+			const auto values = std::span(buffer->m_values).subspan(command.firstValue, command.valueCount);
+			if (command.type == CommandBuffer::CommandType::CreateEntity) {
+				infos.clear();
+				for (const auto& value : values) {
+					infos.emplace_back(value.info);
+				}
+				std::sort(infos.begin(), infos.end(), [](const ComponentInfo* a, const ComponentInfo* b) {
+					return a->id < b->id;
+				});
+
+				Archetype& target = m_getOrCreateArchetype(infos);
+				m_pending_changes.push_back({ Entity{}, nullptr, &target, m_no_pending_value });
+				for (auto& value : values) {
+					m_pushPendingValue(m_pending_changes.back(), value);
+				}
+				continue;
+			}
+
+			PendingChange* change = m_findPendingChange(command.entity);
+			if (!change || !change->target) {
+				// 生きていないか破棄が決まったエンティティへのコマンドは無視する
+				for (auto& value : values) {
+					value.info->destroy(value.data, 1);
+					value.data = nullptr;
+				}
+				continue;
+			}
+
+			switch (command.type) {
+			case CommandBuffer::CommandType::DestroyEntity:
+				m_discardPendingValues(*change, std::nullopt);
+				change->target = nullptr;
+				break;
+			case CommandBuffer::CommandType::AddComponent:
+				m_discardPendingValues(*change, command.componentId);
+				if (!change->target->HasComponent(command.componentId)) {
+					change->target = &m_getArchetypeWith(*change->target, *values.front().info);
+				}
+				m_pushPendingValue(*change, values.front());
+				break;
+			case CommandBuffer::CommandType::RemoveComponent:
+				if (change->target->HasComponent(command.componentId)) {
+					m_discardPendingValues(*change, command.componentId);
+					change->target = &m_getArchetypeWithout(*change->target, command.componentId);
+				}
+				break;
+			default:
+				assert(false);
+				break;
+			}
+		}
+	}
+}
+
+void World::m_applyPendingChanges() {
+	auto& changes = m_pending_changes;
+
+	// 破棄と、アーキタイプが変わらない変更は移動を伴わないので先に行う
+	for (auto& change : changes) {
+		if (!change.source) {
+			continue;
+		}
+
+		if (!change.target) {
+			auto& record = m_entity_records[change.entity.index];
+			record.archetype->DestroyRow(record.row);
+			m_eraseRow(*record.archetype, record.row);
+			m_freeEntity(change.entity);
+		}
+		else if (change.source == change.target) {
+			m_applyPendingValues(change);
+		}
+	}
+
+	// 同じ(移動先, 移動元)の組み合わせを、アーキタイプが作られた順番に並べてまとめて移す
+	m_pending_order.clear();
+	for (uint32_t i = 0; i < changes.size(); ++i) {
+		if (changes[i].source && changes[i].target && changes[i].source != changes[i].target) {
+			m_pending_order.emplace_back(i);
+		}
+	}
+	std::sort(m_pending_order.begin(), m_pending_order.end(), [&](uint32_t a, uint32_t b) {
+		const auto keyA = std::make_tuple(changes[a].target->GetIndex(), changes[a].source->GetIndex(), a);
+		const auto keyB = std::make_tuple(changes[b].target->GetIndex(), changes[b].source->GetIndex(), b);
+		return keyA < keyB;
+	});
+
+	for (size_t begin = 0; begin < m_pending_order.size();) {
+		Archetype& from = *changes[m_pending_order[begin]].source;
+		Archetype& to = *changes[m_pending_order[begin]].target;
+		size_t end = begin + 1;
+		while (end < m_pending_order.size() && changes[m_pending_order[end]].source == &from && changes[m_pending_order[end]].target == &to) {
+			++end;
+		}
+
+		// 前のまとまりを移した時に行が変わっているので、ここで行を読んで並べる
+		const auto group = std::span(m_pending_order).subspan(begin, end - begin);
+		std::sort(group.begin(), group.end(), [&](uint32_t a, uint32_t b) {
+			return m_entity_records[changes[a].entity.index].row < m_entity_records[changes[b].entity.index].row;
+		});
+		m_batch_entities.clear();
+		m_batch_rows.clear();
+		for (uint32_t index : group) {
+			m_batch_entities.emplace_back(changes[index].entity);
+			m_batch_rows.emplace_back(m_entity_records[changes[index].entity.index].row);
+		}
+
+		m_moveEntities(from, to, m_batch_entities, m_batch_rows);
+		for (uint32_t index : group) {
+			m_applyPendingValues(changes[index]);
+		}
+		begin = end;
+	}
+
+	// 作成するエンティティは、アーキタイプ毎にまとめて行を追加する
+	m_pending_order.clear();
+	for (uint32_t i = 0; i < changes.size(); ++i) {
+		if (!changes[i].source) {
+			m_pending_order.emplace_back(i);
+		}
+	}
+	std::sort(m_pending_order.begin(), m_pending_order.end(), [&](uint32_t a, uint32_t b) {
+		return std::make_pair(changes[a].target->GetIndex(), a) < std::make_pair(changes[b].target->GetIndex(), b);
+	});
+
+	for (size_t begin = 0; begin < m_pending_order.size();) {
+		Archetype& to = *changes[m_pending_order[begin]].target;
+		size_t end = begin + 1;
+		while (end < m_pending_order.size() && changes[m_pending_order[end]].target == &to) {
+			++end;
+		}
+
+		const auto group = std::span(m_pending_order).subspan(begin, end - begin);
+		m_batch_entities.clear();
+		uint32_t firstRow = 0;
+		try {
+			for (size_t i = 0; i < group.size(); ++i) {
+				m_batch_entities.emplace_back(m_allocateEntity());
+			}
+			firstRow = to.PushRows(m_batch_entities);
+		}
+		catch (...) {
+			for (Entity entity : m_batch_entities) {
+				m_freeEntity(entity);
+			}
+			throw;
+		}
+
+		for (size_t i = 0; i < group.size(); ++i) {
+			auto& change = changes[group[i]];
+			auto& record = m_entity_records[m_batch_entities[i].index];
+			record.archetype = &to;
+			record.row = firstRow + static_cast<uint32_t>(i);
+			change.entity = m_batch_entities[i];
+			m_applyPendingValues(change);
+		}
+		begin = end;
+	}
+}
+
+void World::m_moveEntities(Archetype& from, Archetype& to, std::span<const Entity> entities, std::span<const uint32_t> rows) {
+	const uint32_t firstToRow = to.PushRows(entities);
+	// ここより後は例外を投げない
+
+	const uint32_t fromCapacity = from.GetChunkCapacity();
+	const uint32_t toCapacity = to.GetChunkCapacity();
+	const auto columns = from.GetColumns();
+	for (size_t fromColumn = 0; fromColumn < columns.size(); ++fromColumn) {
+		const ComponentInfo& info = *columns[fromColumn].info;
+		const size_t toColumn = to.FindColumn(info.id);
+		for (size_t i = 0; i < rows.size();) {
+			// 移動元と移動先の両方で、同じチャンク内に連続している行をまとめる
+			const uint32_t fromRow = rows[i];
+			const uint32_t toRow = firstToRow + static_cast<uint32_t>(i);
+			const size_t maxCount = std::min(fromCapacity - fromRow % fromCapacity, toCapacity - toRow % toCapacity);
+			size_t count = 1;
+			while (count < maxCount && i + count < rows.size() && rows[i + count] == fromRow + count) {
+				++count;
+			}
+
+			void* source = from.GetComponentData(fromRow, fromColumn);
+			if (toColumn != Archetype::npos) {
+				info.relocate(to.GetComponentData(toRow, toColumn), source, count);
+			}
+			else {
+				info.destroy(source, count);
+			}
+			i += count;
+		}
+	}
+
+	// 降順に取り除けば、末尾から埋めに来る行が移したエンティティであることはない
+	for (size_t i = rows.size(); i-- > 0;) {
+		m_eraseRow(from, rows[i]);
+	}
+	for (size_t i = 0; i < entities.size(); ++i) {
+		auto& record = m_entity_records[entities[i].index];
+		record.archetype = &to;
+		record.row = firstToRow + static_cast<uint32_t>(i);
+	}
+}
+
+World::PendingChange* World::m_findPendingChange(Entity entity) {
+	if (!IsAlive(entity)) {
+		return nullptr;
+	}
+
+	auto [it, inserted] = m_pending_change_by_entity.try_emplace(entity.index, static_cast<uint32_t>(m_pending_changes.size()));
+	if (inserted) {
+		Archetype* archetype = m_entity_records[entity.index].archetype;
+		try {
+			m_pending_changes.push_back({ entity, archetype, archetype, m_no_pending_value });
+		}
+		catch (...) {
+			m_pending_change_by_entity.erase(it);
+			throw;
+		}
+	}
+
+	return &m_pending_changes[it->second];
+}
+
+void World::m_pushPendingValue(PendingChange& change, CommandBuffer::Value& value) {
+	m_pending_values.push_back({ &value, change.firstValue });
+	change.firstValue = static_cast<uint32_t>(m_pending_values.size() - 1);
+}
+
+void World::m_discardPendingValues(PendingChange& change, std::optional<ComponentTypeId> id) noexcept {
+	for (uint32_t i = change.firstValue; i != m_no_pending_value; i = m_pending_values[i].next) {
+		auto& value = *m_pending_values[i].value;
+		if (value.data && (!id || value.info->id == *id)) {
+			value.info->destroy(value.data, 1);
+			value.data = nullptr;
+		}
+	}
+}
+
+void World::m_applyPendingValues(const PendingChange& change) noexcept {
+	const auto& record = m_entity_records[change.entity.index];
+	for (uint32_t i = change.firstValue; i != m_no_pending_value; i = m_pending_values[i].next) {
+		auto& value = *m_pending_values[i].value;
+		if (!value.data) {
+			continue;
+		}
+
+		// 移動元から持っていたものはムーブ済みなので、破棄してから置き換える
+		void* dest = change.target->GetComponentData(record.row, change.target->FindColumn(value.info->id));
+		if (change.source && change.source->HasComponent(value.info->id)) {
+			value.info->destroy(dest, 1);
+		}
+		value.info->relocate(dest, value.data, 1);
+		value.data = nullptr;
+	}
+}
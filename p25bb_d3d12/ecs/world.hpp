@@ -0,0 +1,240 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "entity.hpp"
+#include "component.hpp"
+#include "archetype.hpp"
+#include "command_buffer.hpp"
+#include "../helpers/hash.hpp"
+#include "../exceptions/invalid_argument.hpp"
+
+namespace PameECS::ECS {
+	// エンティティとアーキタイプを持ち、エンティティから(アーキタイプ, 行)を引く
+	// コンポーネントの追加と削除はエンティティを別のアーキタイプに移すので、チャンクを走査している間に行ってはいけない
+	// スレッドセーフではない
+	class World {
+	public:
+		World();
+		~World() = default;
+		World(const World&) = delete;
+		World& operator=(const World&) = delete;
+
+		Entity CreateEntity();
+		template<typename... Ts>
+			requires (sizeof...(Ts) > 0 && (Component<std::remove_cvref_t<Ts>> && ...))
+		Entity CreateEntity(Ts&&... components);
+		// 破棄済みのエンティティではInvalidArgumentを投げる
+		void DestroyEntity(Entity entity);
+		bool IsAlive(Entity entity) const noexcept;
+
+		// 既に持っていれば置き換える
+		template<Component T, typename... Args>
+		T& AddComponent(Entity entity, Args&&... args);
+		// 持っていなければ何もせずfalseを返す
+		template<Component T>
+		bool RemoveComponent(Entity entity);
+		template<Component T>
+		bool HasComponent(Entity entity) const {
+			const auto& record = m_getRecord(entity);
+			return record.archetype->HasComponent(GetComponentTypeId<T>());
+		}
+		// 持っていなければInvalidArgumentを投げる
+		// 返す参照は、次にエンティティの構成が変わるまで有効
+		template<Component T>
+		T& GetComponent(Entity entity) const {
+			T* component = TryGetComponent<T>(entity);
+			if (!component) {
+				throw Exceptions::InvalidArgument("The entity does not have the component.");
+			}
+			return *component;
+		}
+		template<Component T>
+		T* TryGetComponent(Entity entity) const {
+			const auto& record = m_getRecord(entity);
+			const size_t column = record.archetype->FindColumn(GetComponentTypeId<T>());
+			return column != Archetype::npos ? static_cast<T*>(record.archetype->GetComponentData(record.row, column)) : nullptr;
+		}
+
+		// buffersの順番に、各バッファ内では記録した順番に適用したのと同じ結果になるように再生し、全てのバッファを空にする
+		// エンティティ毎にコマンドをまとめてから、移動元と移動先のアーキタイプが同じエンティティを行の順番にまとめて移すので、
+		// チャンク内で連続した行のコンポーネントは1回のムーブ(トリビアルであればmemcpy)で移る
+		// 例外を投げた場合は、まだ再生していないコマンドを捨てる
+		void ApplyCommands(std::span<CommandBuffer* const> buffers);
+		void ApplyCommands(CommandBuffer& buffer) {
+			CommandBuffer* buffers[] = { &buffer };
+			ApplyCommands(buffers);
+		}
+
+		size_t GetEntityCount() const noexcept {
+			return m_entity_count;
+		}
+		// 作られた順番に並び、一度作られたアーキタイプは削除されない
+		std::span<const std::unique_ptr<Archetype>> GetArchetypes() const noexcept {
+			return m_archetypes;
+		}
+	private:
+		struct EntityRecord {
+			Archetype* archetype = nullptr; // nullptrであれば破棄済み
+			uint32_t row = 0;
+			uint32_t generation = 0;
+		};
+
+		struct PendingChange {
+			Entity entity; // CreateEntityでは再生時に割り当てる
+			Archetype* source; // CreateEntityではnullptr
+			Archetype* target; // 破棄するならnullptr
+			uint32_t firstValue; // m_pending_valuesの中の連結リストの先頭
+		};
+		struct PendingValue {
+			CommandBuffer::Value* value;
+			uint32_t next;
+		};
+		inline static constexpr uint32_t m_no_pending_value = std::numeric_limits<uint32_t>::max();
+
+		struct SignatureHash {
+			size_t operator()(const std::vector<ComponentTypeId>& signature) const noexcept {
+				return static_cast<size_t>(Helpers::Hash::Fnv1a64(std::string_view(
+					reinterpret_cast<const char*>(signature.data()), signature.size() * sizeof(ComponentTypeId))));
+			}
+		};
+
+		const EntityRecord& m_getRecord(Entity entity) const;
+		EntityRecord& m_getRecord(Entity entity) {
+			return const_cast<EntityRecord&>(std::as_const(*this).m_getRecord(entity));
+		}
+		// 破棄済みのインデックスがあれば再利用する、アーキタイプには入れない
+		Entity m_allocateEntity();
+		void m_freeEntity(Entity entity) noexcept;
+
+		// componentsはIDの昇順で重複がないこと
+		Archetype& m_getOrCreateArchetype(std::vector<const ComponentInfo*> components);
+		Archetype& m_getArchetypeWith(Archetype& from, const ComponentInfo& component);
+		Archetype& m_getArchetypeWithout(Archetype& from, ComponentTypeId id);
+		// エンティティをtoの末尾に移し、共通するコンポーネントはムーブ、toにないものは破棄する
+		// toにだけあるコンポーネントは未初期化なので、呼び出し側で構築すること
+		void m_moveEntity(Entity entity, EntityRecord& record, Archetype& to);
+		// 行を取り除き、末尾から移ってきたエンティティの行を更新する
+		void m_eraseRow(Archetype& archetype, uint32_t row) noexcept;
+
+		// コマンドをエンティティ毎の変更にまとめる、ワールドのアーキタイプ以外は変えない
+		void m_foldCommands(std::span<CommandBuffer* const> buffers);
+		void m_applyPendingChanges();
+		// rowsは昇順でentitiesと同じ順番、toの末尾にまとめて移す
+		void m_moveEntities(Archetype& from, Archetype& to, std::span<const Entity> entities, std::span<const uint32_t> rows);
+		// 生きていなければnullptr、返すポインターはm_pending_changesに追加するまで有効
+		PendingChange* m_findPendingChange(Entity entity);
+		void m_pushPendingValue(PendingChange& change, CommandBuffer::Value& value);
+		// idと同じコンポーネントの値を破棄する、nulloptであれば全ての値
+		void m_discardPendingValues(PendingChange& change, std::optional<ComponentTypeId> id) noexcept;
+		// まだムーブしていない値を、entityの行に構築するか置き換える
+		void m_applyPendingValues(const PendingChange& change) noexcept;
+
+		std::vector<EntityRecord> m_entity_records; // Entity::indexで引く
+		std::vector<uint32_t> m_free_indexes;
+		size_t m_entity_count = 0;
+
+		std::vector<std::unique_ptr<Archetype>> m_archetypes;
+		std::unordered_map<std::vector<ComponentTypeId>, Archetype*, SignatureHash> m_archetype_by_signature;
+		Archetype* m_empty_archetype = nullptr;
+
+		// ApplyCommandsの間だけ使う、確保し直さないようにメンバーに持つ
+		std::vector<PendingChange> m_pending_changes;
+		std::vector<PendingValue> m_pending_values;
+		std::unordered_map<uint32_t, uint32_t> m_pending_change_by_entity;
+		std::vector<uint32_t> m_pending_order;
+		std::vector<Entity> m_batch_entities;
+		std::vector<uint32_t> m_batch_rows;
+	};
+
+	template<typename... Ts>
+		requires (sizeof...(Ts) > 0 && (Component<std::remove_cvref_t<Ts>> && ...))
+	Entity World::CreateEntity(Ts&&... components) {
+		std::vector<const ComponentInfo*> infos = { &GetComponentInfo<std::remove_cvref_t<Ts>>()... };
+		std::sort(infos.begin(), infos.end(), [](const ComponentInfo* a, const ComponentInfo* b) {
+			return a->id < b->id;
+		});
+		if (std::adjacent_find(infos.begin(), infos.end()) != infos.end()) {
+			throw Exceptions::InvalidArgument("The same component type is specified more than once.");
+		}
+
+		Archetype& archetype = m_getOrCreateArchetype(std::move(infos));
+		const Entity entity = m_allocateEntity();
+		uint32_t row = 0;
+		try {
+			row = archetype.PushRow(entity);
+		}
+		catch (...) {
+			m_freeEntity(entity);
+			throw;
+		}
+
+		// 構築の途中で例外が投げられたら、構築済みのものだけを破棄して行を戻す
+		std::array<bool, sizeof...(Ts)> isConstructed = {};
+		size_t index = 0;
+		try {
+			([&] {
+				using T = std::remove_cvref_t<Ts>;
+				const size_t column = archetype.FindColumn(GetComponentTypeId<T>());
+				std::construct_at(static_cast<T*>(archetype.GetComponentData(row, column)), std::forward<Ts>(components));
+				isConstructed[index++] = true;
+			}(), ...);
+		}
+		catch (...) {
+			index = 0;
+			([&] {
+				using T = std::remove_cvref_t<Ts>;
+				if (isConstructed[index++]) {
+					std::destroy_at(static_cast<T*>(archetype.GetComponentData(row, archetype.FindColumn(GetComponentTypeId<T>()))));
+				}
+			}(), ...);
+			archetype.EraseRow(row);
+			m_freeEntity(entity);
+			throw;
+		}
+
+		auto& record = m_entity_records[entity.index];
+		record.archetype = &archetype;
+		record.row = row;
+		return entity;
+	}
+
+	template<Component T, typename... Args>
+	T& World::AddComponent(Entity entity, Args&&... args) {
+		auto& record = m_getRecord(entity);
+		// 移動した後に構築が失敗すると戻せないので、先に構築しておく
+		T value(std::forward<Args>(args)...);
+
+		const size_t column = record.archetype->FindColumn(GetComponentTypeId<T>());
+		if (column != Archetype::npos) {
+			T* component = static_cast<T*>(record.archetype->GetComponentData(record.row, column));
+			std::destroy_at(component);
+			return *std::construct_at(component, std::move(value));
+		}
+
+		Archetype& to = m_getArchetypeWith(*record.archetype, GetComponentInfo<T>());
+		m_moveEntity(entity, record, to);
+		return *std::construct_at(static_cast<T*>(to.GetComponentData(record.row, to.FindColumn(GetComponentTypeId<T>()))), std::move(value));
+	}
+
+	template<Component T>
+	bool World::RemoveComponent(Entity entity) {
+		auto& record = m_getRecord(entity);
+		const ComponentTypeId id = GetComponentTypeId<T>();
+		if (!record.archetype->HasComponent(id)) {
+			return false;
+		}
+
+		m_moveEntity(entity, record, m_getArchetypeWithout(*record.archetype, id));
+		return true;
+	}
+}
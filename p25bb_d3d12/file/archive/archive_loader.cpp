@@ -1,101 +1,536 @@
 #include "archive_loader.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include "../../helpers/compress.hpp"
 #include "../../helpers/crc.hpp"
+#include "../../helpers/hash.hpp"
+#include "../../helpers/path.hpp"
 #include "../../exceptions/file_error.hpp"
+#include "../../exceptions/invalid_operation.hpp"
+#include "mapped_read_backend.hpp"
+#include "positional_read_backend.hpp"
+
+#ifdef _WIN32
+// std::min/std::maxがマクロに置き換えられないようにする
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 using PameECS::File::Archive::ArchiveLoader;
 
-ArchiveLoader::ArchiveLoader(const std::filesystem::path& path, std::shared_ptr<BS::thread_pool<0U>> threadPool, std::shared_ptr<spdlog::logger> logger)
-	: m_thread_pool(threadPool), m_logger(logger) {
+ArchiveLoader::ArchiveLoader(
+	const std::filesystem::path& path,
+	std::shared_ptr<BS::thread_pool<0U>> threadPool,
+	std::shared_ptr<spdlog::logger> logger,
+	const Properties& properties)
+	: ArchiveLoader(m_createReadBackend(path, properties), threadPool, logger, properties) {
+}
+
+ArchiveLoader::ArchiveLoader(
+	std::shared_ptr<IReadBackend> backend,
+	std::shared_ptr<BS::thread_pool<0U>> threadPool,
+	std::shared_ptr<spdlog::logger> logger,
+	const Properties& properties)
+	: m_thread_pool(threadPool), m_backend(backend), m_logger(logger) {
 	assert(m_thread_pool);
 	assert(m_logger);
+	if (!m_backend) {
+		throw Exceptions::InvalidArgument("The read backend is null.");
+	}
+	m_mapped_data = m_backend->GetMappedData();
+
+	m_chunks_per_task = std::max<size_t>(1, properties.chunksPerTask.value_or(m_default_chunks_per_task));
+	m_prefetch_chunks_per_task = std::max<size_t>(1, properties.prefetchChunksPerTask.value_or(m_default_prefetch_chunks_per_task));
 
-	m_fileMap(path);
 	m_loadAndVerifyHeader();
+
+	// チャンクサイズはヘッダーで決まるので、キャッシュはその後に作る
+	const size_t minChunkCacheBytes = m_chunk_size * m_min_cached_chunks_per_shard;
+	const size_t chunkCacheBytes = properties.chunkCacheBytes.value_or(std::max(m_default_chunk_cache_bytes, minChunkCacheBytes));
+	if (chunkCacheBytes > 0) {
+		if (chunkCacheBytes < m_chunk_size) {
+			throw Exceptions::InvalidArgument("The chunk cache budget is smaller than the chunk size.");
+		}
+		const size_t shardCount = std::clamp<size_t>(chunkCacheBytes / minChunkCacheBytes, 1, ChunkCache::defaultShardCount);
+		m_chunk_cache = std::make_unique<ChunkCache>(chunkCacheBytes, shardCount);
+	}
 	m_loadSizeInformationFromLastRead();
-	size_t sizeToRead =
+	if (m_hasDictionaryInformation()) {
+		m_loadDictionaryInformationFromLastRead();
+	}
+	const size_t sectionsStartPosition = m_last_read;
+	const size_t metadataSize =
 		m_size_info.entryCompressedSize
 		+ m_size_info.dataChunkIndexCompressedSize
-		+ m_size_info.totalDataChunkCompressedSize;
-	std::vector<uint8_t> data(sizeToRead);
-	m_readData(data.data(), sizeToRead);
-	m_loadAndVerifyFooterFromLastRead(data);
+		+ m_dictionary_info.dictionarySize;
+	const size_t sizeToRead = metadataSize + m_size_info.totalDataChunkCompressedSize;
+	// データチャンクは読み込み時に必要な分だけ読むので、ここではその手前までを読む
+	std::vector<uint8_t> metadataBuffer;
+	auto data = m_viewData(metadataSize, m_last_read, metadataBuffer);
+	m_last_read += sizeToRead;
+	m_loadAndVerifyFooterFromLastRead(sectionsStartPosition, sizeToRead, properties.verificationPolicy.value_or(VerificationPolicy::Eager));
 
 	size_t readPosition = 0;
 
 	m_constructEntries(data, readPosition);
 	m_loadDataChunkRanges(data, readPosition);
+	m_loadDictionary(data, readPosition);
+
+	m_data_start_position = sectionsStartPosition + readPosition;
 
-	m_data_start_position = sizeof(Types::Header)
-		+ sizeof(Types::SizeInformation)
-		+ m_size_info.entryCompressedSize
-		+ m_size_info.dataChunkIndexCompressedSize;
+	m_markStoredEntries();
 }
 
 std::future<std::vector<uint8_t>> ArchiveLoader::GetFileDataAsync(const Types::Entry& entry) const {
-	auto start = entry.dataOffset / m_chunk_size;
-	auto end = (entry.dataOffset + entry.dataSize - 1) / m_chunk_size;
+	if (!IsFile(entry)) {
+		throw Exceptions::InvalidArgument("The entry is not a file.");
+	}
 
-	std::vector<std::future<std::array<uint8_t, m_chunk_size>>> chunkDataFutures;
+	auto fileData = std::make_shared<std::vector<uint8_t>>(entry.dataSize);
 
-	for (size_t i = start; i <= end; ++i) {
-		chunkDataFutures.emplace_back(m_getChunkDataAsync(i));
+	return m_readRangeAsync(entry.dataOffset, *fileData,
+		[fileData]() {
+			return std::move(*fileData);
+		}
+	);
+}
+
+std::future<void> ArchiveLoader::GetFileDataAsync(const Types::Entry& entry, std::span<uint8_t> dest) const {
+	m_validateFileDestination(entry, dest);
+
+	return m_readRangeAsync(entry.dataOffset, dest.first(entry.dataSize), []() {});
+}
+
+std::future<void> ArchiveLoader::ReadRangeAsync(const Types::Entry& entry, uint64_t offset, uint64_t length, std::span<uint8_t> dest) const {
+	if (!IsFile(entry)) {
+		throw Exceptions::InvalidArgument("The entry is not a file.");
+	}
+	if (offset > entry.dataSize || length > entry.dataSize - offset) {
+		throw Exceptions::InvalidArgument("The range is out of the file.");
+	}
+	if (dest.size() < length) {
+		throw Exceptions::InvalidArgument("The destination buffer is smaller than the range.");
 	}
 
-	auto func = [this, entry](std::vector<std::future<std::array<uint8_t, m_chunk_size>>>&& futures) mutable -> std::vector<uint8_t> {
-		std::pair<size_t, size_t> clip = {
-			entry.dataOffset % m_chunk_size,
-			((entry.dataOffset + entry.dataSize) % m_chunk_size) == 0
-				? 0 : (m_chunk_size - (entry.dataOffset + entry.dataSize) % m_chunk_size)
-		};
+	if (length == 0) {
+		std::promise<void> completed;
+		completed.set_value();
+		return completed.get_future();
+	}
 
-		std::vector<uint8_t> fileData;
-		for (auto& future : futures) {
-			auto chunkData = future.get();
-			fileData.insert(fileData.end(), chunkData.begin(), chunkData.end());
-		}
+	return m_readRangeAsync(entry.dataOffset + offset, dest.first(length), []() {});
+}
+
+std::future<std::vector<std::vector<uint8_t>>> ArchiveLoader::GetFilesDataAsync(std::span<const std::string> virtualPaths) const {
+	struct BatchState {
+		std::vector<std::vector<uint8_t>> filesData;
+		std::vector<uint64_t> dataOffsets;
+		// (チャンクのインデックス, ファイルのインデックス)
+		std::vector<std::pair<size_t, size_t>> chunkTargets;
+	};
+
+	auto state = std::make_shared<BatchState>();
+	state->filesData.resize(virtualPaths.size());
+	state->dataOffsets.resize(virtualPaths.size());
 
-		if (clip.first > 0) {
-			fileData.erase(fileData.begin(), fileData.begin() + clip.first);
+	for (size_t i = 0; i < virtualPaths.size(); ++i) {
+		const auto& entry = GetEntry(virtualPaths[i]);
+		if (!IsFile(entry)) {
+			throw Exceptions::InvalidArgument("The entry is not a file.");
 		}
-		if (clip.second > 0) {
-			fileData.erase(fileData.end() - clip.second, fileData.end());
+
+		state->filesData[i].resize(entry.dataSize);
+		state->dataOffsets[i] = entry.dataOffset;
+
+		auto start = entry.dataOffset / m_chunk_size;
+		auto end = (entry.dataOffset + entry.dataSize - 1) / m_chunk_size;
+		for (size_t chunkIndex = start; chunkIndex <= end; ++chunkIndex) {
+			state->chunkTargets.emplace_back(chunkIndex, i);
 		}
+	}
 
-		return fileData;
-	};
+	// 同じチャンクを必要とするファイルをまとめて、チャンク毎に一度だけ展開する
+	std::sort(state->chunkTargets.begin(), state->chunkTargets.end());
 
-	return m_thread_pool->submit_task(
-		[func, futures = std::move(chunkDataFutures)]() mutable {
-			return func(std::move(futures));
+	// 同じチャンクを必要とする要素の先頭位置、最後は番兵
+	std::vector<size_t> groupBegins;
+	for (size_t i = 0; i < state->chunkTargets.size(); ++i) {
+		if (i == 0 || state->chunkTargets[i].first != state->chunkTargets[i - 1].first) {
+			groupBegins.emplace_back(i);
+		}
+	}
+	const size_t groupCount = groupBegins.size();
+	groupBegins.emplace_back(state->chunkTargets.size());
+
+	return Thread::DetachBlocksAsync(
+		*m_thread_pool, size_t{ 0 }, groupCount,
+		[this, state, groupBegins = std::move(groupBegins)](const size_t blockBegin, const size_t blockEnd) {
+			for (size_t group = blockBegin; group < blockEnd; ++group) {
+				const size_t groupBegin = groupBegins[group];
+				const size_t groupEnd = groupBegins[group + 1];
+				const size_t chunkIndex = state->chunkTargets[groupBegin].first;
+
+				if (groupEnd - groupBegin == 1) {
+					const size_t fileIndex = state->chunkTargets[groupBegin].second;
+					m_readChunk(chunkIndex, state->dataOffsets[fileIndex], state->filesData[fileIndex]);
+					continue;
+				}
+
+				// 圧縮されていないチャンクは、格納されたものから直接コピーする
+				const bool isRaw = m_isRawChunk(chunkIndex);
+				std::vector<uint8_t> buffer;
+				auto chunkData = isRaw ? nullptr : m_getChunkData(chunkIndex);
+				const std::span<const uint8_t> chunkView = isRaw ? m_readStoredChunks(chunkIndex, chunkIndex + 1, buffer) : std::span<const uint8_t>(*chunkData);
+				for (size_t i = groupBegin; i < groupEnd; ++i) {
+					const size_t fileIndex = state->chunkTargets[i].second;
+					m_copyChunkData(chunkIndex, chunkView, state->dataOffsets[fileIndex], state->filesData[fileIndex]);
+				}
+			}
+		},
+		m_chunks_per_task,
+		[state]() {
+			return std::move(state->filesData);
 		}
 	);
 }
 
-std::future<std::array<uint8_t, ArchiveLoader::m_chunk_size>> ArchiveLoader::m_getChunkDataAsync(size_t chunkIndex) const {
-	return m_thread_pool->submit_task(
-		[this, chunkIndex]() -> std::array<uint8_t, m_chunk_size> {
-			const auto& [offset, size] = m_data_chunk_ranges.at(chunkIndex);
-			std::vector<uint8_t> compressed = std::vector<uint8_t>(size);
-			m_readData(compressed.data(), size, m_data_start_position + offset);
-			// ZStdDecompressは厳密にm_chunk_sizeバイトのデータを返すはずなので、サイズの確認は必要ない
-			std::vector<uint8_t> decompressed = Helpers::Compress::ZStdDecompress(compressed, m_chunk_size);
-			std::array<uint8_t, m_chunk_size> result;
-			std::copy(decompressed.begin(), decompressed.end(), result.begin());
-			return result;
+std::span<const uint8_t> ArchiveLoader::GetStoredFileData(const Types::Entry& entry) const {
+	if (!IsStored(entry)) {
+		throw Exceptions::InvalidArgument("The entry is not stored without compression.");
+	}
+	if (m_mapped_data.empty()) {
+		throw Exceptions::InvalidOperation("The archive file is not mapped.");
+	}
+
+	// 無圧縮のチャンクは展開後と同じ並びで連続しているので、最初のチャンクからの位置がそのまま使える
+	const size_t firstChunk = entry.dataOffset / m_chunk_size;
+	const uint64_t position = m_data_start_position
+		+ m_data_chunk_ranges[firstChunk].first
+		+ (entry.dataOffset - firstChunk * m_chunk_size);
+
+	std::vector<uint8_t> unused;
+	return m_viewData(entry.dataSize, position, unused);
+}
+
+std::span<const PameECS::File::Archive::Types::Entry> ArchiveLoader::GetDirectoryEntries(std::string_view virtualPath) const {
+	if (virtualPath.empty()) {
+		return GetRootEntries();
+	}
+
+	const auto& entry = GetEntry(virtualPath);
+	if (!IsDirectory(entry)) {
+		throw Exceptions::InvalidArgument("The entry is not a directory.");
+	}
+
+	return GetChildren(entry);
+}
+
+std::span<const PameECS::File::Archive::Types::Entry> ArchiveLoader::GetDescendants(std::string_view virtualPath) const {
+	if (virtualPath.empty()) {
+		return m_entries;
+	}
+
+	const auto& entry = GetEntry(virtualPath);
+	if (!IsDirectory(entry)) {
+		throw Exceptions::InvalidArgument("The entry is not a directory.");
+	}
+
+	return GetDescendants(entry);
+}
+
+std::span<const PameECS::File::Archive::Types::Entry> ArchiveLoader::m_getGlobSearchRange(std::string_view pattern) const {
+	// ワイルドカードより前の、最後の区切りまでがディレクトリとして決まっている
+	const std::string_view literal = pattern.substr(0, pattern.find_first_of("*?"));
+	const size_t separator = literal.rfind('/');
+
+	const Types::Entry* directory = nullptr;
+	if (separator != std::string_view::npos) {
+		directory = m_findEntry(pattern.substr(0, separator));
+		if (!directory || !IsDirectory(*directory)) {
+			return {};
+		}
+	}
+
+	// 残りに区切りも"**"もなければ、直下のエントリだけが一致し得る
+	const std::string_view rest = separator == std::string_view::npos ? pattern : pattern.substr(separator + 1);
+	const bool isShallow = rest.find('/') == std::string_view::npos && rest.find("**") == std::string_view::npos;
+
+	if (!directory) {
+		return isShallow ? GetRootEntries() : std::span<const Types::Entry>(m_entries);
+	}
+	return isShallow ? GetChildren(*directory) : GetDescendants(*directory);
+}
+
+ArchiveLoader::PrefetchHandle ArchiveLoader::Prefetch(std::span<const std::string_view> virtualPaths) const {
+	auto state = std::make_shared<PrefetchState>();
+	for (auto virtualPath : virtualPaths) {
+		m_collectPrefetchChunks(GetEntry(virtualPath), state->chunkIndexes);
+	}
+
+	// ファイル内の順番に読む方が、ページインの効率が良い
+	std::sort(state->chunkIndexes.begin(), state->chunkIndexes.end());
+	state->chunkIndexes.erase(std::unique(state->chunkIndexes.begin(), state->chunkIndexes.end()), state->chunkIndexes.end());
+
+	PrefetchHandle handle;
+	state->stopToken = handle.stopSource.get_token();
+	handle.completion = state->completion.get_future().share();
+
+	m_schedulePrefetch(std::move(state));
+
+	return handle;
+}
+
+void ArchiveLoader::m_collectPrefetchChunks(const Types::Entry& entry, std::vector<size_t>& chunkIndexes) const {
+	if (IsFile(entry)) {
+		const size_t start = entry.dataOffset / m_chunk_size;
+		const size_t end = (entry.dataOffset + entry.dataSize - 1) / m_chunk_size;
+		for (size_t chunkIndex = start; chunkIndex <= end; ++chunkIndex) {
+			chunkIndexes.emplace_back(chunkIndex);
 		}
-	);
+		return;
+	}
+
+	for (const auto& child : GetChildren(entry)) {
+		m_collectPrefetchChunks(child, chunkIndexes);
+	}
+}
+
+void ArchiveLoader::m_schedulePrefetch(std::shared_ptr<PrefetchState> state) const {
+	m_thread_pool->detach_task([this, state = std::move(state)]() mutable {
+		try {
+			const size_t end = std::min(state->next + m_prefetch_chunks_per_task, state->chunkIndexes.size());
+			for (; state->next < end && !state->stopToken.stop_requested(); ++state->next) {
+				m_prefetchChunk(state->chunkIndexes[state->next]);
+			}
+		}
+		catch (...) {
+			state->completion.set_exception(std::current_exception());
+			return;
+		}
+
+		if (state->next >= state->chunkIndexes.size() || state->stopToken.stop_requested()) {
+			state->completion.set_value();
+			return;
+		}
+
+		// 間に積まれた通常の読み込みが先に処理されるように、続きはキューの末尾に並び直す
+		m_schedulePrefetch(std::move(state));
+	});
 }
 
-void ArchiveLoader::m_fileMap(const std::filesystem::path& path) {
-	m_file_map = boost::interprocess::file_mapping(path.c_str(), boost::interprocess::read_only);
-	m_file_view = boost::interprocess::mapped_region(m_file_map, boost::interprocess::read_only);
+void ArchiveLoader::m_prefetchChunk(size_t chunkIndex) const {
+	// 無圧縮のチャンクは読み込み時に格納されたものから直接コピーするので、OSに先読みを頼むだけでよい
+	// マップされていなければ、読み捨ててOSのファイルキャッシュに載せておく
+	if (m_isRawChunk(chunkIndex) || !m_chunk_cache) {
+		std::vector<uint8_t> buffer;
+		auto stored = m_readStoredChunks(chunkIndex, chunkIndex + 1, buffer);
+		if (!m_mapped_data.empty()) {
+			m_prefetchPages(stored);
+		}
+		return;
+	}
+
+	m_getChunkData(chunkIndex);
+}
+
+void ArchiveLoader::m_prefetchPages(std::span<const uint8_t> data) {
+	if (data.empty()) {
+		return;
+	}
+
+	// ワーカーを塞がないように、OSに非同期の先読みを頼む
+#ifdef _WIN32
+	WIN32_MEMORY_RANGE_ENTRY range = { const_cast<uint8_t*>(data.data()), data.size() };
+	if (PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0)) {
+		return;
+	}
+#else
+	// madviseはページの境界から始める必要がある
+	const long pageSize = sysconf(_SC_PAGESIZE);
+	if (pageSize > 0) {
+		const uintptr_t begin = reinterpret_cast<uintptr_t>(data.data()) / pageSize * pageSize;
+		const uintptr_t end = reinterpret_cast<uintptr_t>(data.data()) + data.size();
+		if (madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED) == 0) {
+			return;
+		}
+	}
+#endif
+
+	// 先読みを頼めなければ、各ページを読んでページフォールトを先に起こしておく
+	// 最適化で読み込みが消されないように、volatileで読む
+	const volatile uint8_t* bytes = data.data();
+	uint8_t sink = 0;
+	for (size_t i = 0; i < data.size(); i += m_page_size) {
+		sink ^= bytes[i];
+	}
+	sink ^= bytes[data.size() - 1];
+	(void)sink;
+}
+
+void ArchiveLoader::m_validateFileDestination(const Types::Entry& entry, std::span<const uint8_t> dest) const {
+	if (!IsFile(entry)) {
+		throw Exceptions::InvalidArgument("The entry is not a file.");
+	}
+	if (dest.size() < entry.dataSize) {
+		throw Exceptions::InvalidArgument("The destination buffer is smaller than the file.");
+	}
+}
+
+void ArchiveLoader::m_readChunk(size_t chunkIndex, uint64_t rangeOffset, std::span<uint8_t> dest, std::span<const uint8_t> stored) const {
+	if (ChunkCache::ChunkData cached = m_findCachedChunk(chunkIndex)) {
+		m_copyChunkData(chunkIndex, *cached, rangeOffset, dest);
+		return;
+	}
+
+	m_readUncachedChunk(chunkIndex, rangeOffset, dest, stored);
+}
+
+void ArchiveLoader::m_readUncachedChunk(size_t chunkIndex, uint64_t rangeOffset, std::span<uint8_t> dest, std::span<const uint8_t> stored) const {
+	const uint64_t chunkBegin = chunkIndex * m_chunk_size;
+	const uint64_t chunkEnd = chunkBegin + m_chunk_size;
+
+	std::vector<uint8_t> buffer;
+	if (stored.empty()) {
+		stored = m_readStoredChunks(chunkIndex, chunkIndex + 1, buffer);
+	}
+
+	// 圧縮されていないチャンクは、展開もキャッシュもせずにコピーする
+	if (m_isRawChunk(chunkIndex)) {
+		m_copyChunkData(chunkIndex, stored, rangeOffset, dest);
+		return;
+	}
+
+	// チャンク全体が範囲に含まれる場合は、中間バッファを経由せずに展開する
+	// 大きいファイルの読み込みでキャッシュが追い出されないように、この場合はキャッシュに入れない
+	if (rangeOffset <= chunkBegin && chunkEnd <= rangeOffset + dest.size()) {
+		m_decompressChunk(chunkIndex, stored, dest.subspan(chunkBegin - rangeOffset, m_chunk_size));
+		return;
+	}
+
+	// 範囲の端のチャンクは、隣接する小さいファイルと共有されている可能性が高いのでキャッシュする
+	auto chunkData = std::make_shared<std::vector<uint8_t>>(m_chunk_size);
+	m_decompressChunk(chunkIndex, stored, *chunkData);
+	if (m_chunk_cache) {
+		m_chunk_cache->Insert(chunkIndex, chunkData);
+	}
+	m_copyChunkData(chunkIndex, *chunkData, rangeOffset, dest);
+}
+
+void ArchiveLoader::m_readChunks(size_t first, size_t last, uint64_t rangeOffset, std::span<uint8_t> dest) const {
+	ChunkCache::ChunkData cached = m_findCachedChunk(first);
+	for (size_t i = first; i < last;) {
+		if (cached) {
+			m_copyChunkData(i, *cached, rangeOffset, dest);
+			++i;
+			cached = i < last ? m_findCachedChunk(i) : nullptr;
+			continue;
+		}
+
+		// 次にキャッシュにあるチャンクの手前までを1回で読む、見つけたものは次の周回で使う
+		size_t runEnd = i + 1;
+		while (runEnd < last && !(cached = m_findCachedChunk(runEnd))) {
+			++runEnd;
+		}
+
+		auto stored = m_readStoredChunks(i, runEnd, m_getThreadLocalReadBuffer());
+		for (size_t j = i; j < runEnd; ++j) {
+			m_readUncachedChunk(j, rangeOffset, dest, m_sliceStoredChunk(stored, i, j));
+		}
+		i = runEnd;
+	}
+}
+
+void ArchiveLoader::m_copyChunkData(size_t chunkIndex, std::span<const uint8_t> chunkData, uint64_t rangeOffset, std::span<uint8_t> dest) const {
+	const uint64_t chunkBegin = chunkIndex * m_chunk_size;
+	const uint64_t copyBegin = std::max(chunkBegin, rangeOffset);
+	const uint64_t copyEnd = std::min(chunkBegin + m_chunk_size, rangeOffset + dest.size());
+
+	std::memcpy(
+		dest.data() + (copyBegin - rangeOffset),
+		chunkData.data() + (copyBegin - chunkBegin),
+		copyEnd - copyBegin);
+}
+
+PameECS::File::Archive::ChunkCache::ChunkData ArchiveLoader::m_getChunkData(size_t chunkIndex, std::span<const uint8_t> stored) const {
+	ChunkCache::ChunkData cached = m_chunk_cache ? m_chunk_cache->Find(chunkIndex) : nullptr;
+	if (cached) {
+		return cached;
+	}
+
+	std::vector<uint8_t> buffer;
+	if (stored.empty()) {
+		stored = m_readStoredChunks(chunkIndex, chunkIndex + 1, buffer);
+	}
+
+	auto chunkData = std::make_shared<std::vector<uint8_t>>(m_chunk_size);
+	m_decompressChunk(chunkIndex, stored, *chunkData);
+
+	if (m_chunk_cache) {
+		m_chunk_cache->Insert(chunkIndex, chunkData);
+	}
+
+	return chunkData;
+}
+
+void ArchiveLoader::m_decompressChunk(size_t chunkIndex, std::span<const uint8_t> stored, std::span<uint8_t> dest) const {
+	if (m_isRawChunk(chunkIndex)) {
+		std::memcpy(dest.data(), stored.data(), m_chunk_size);
+		return;
+	}
+
+	// ZStdDecompressは厳密にm_chunk_sizeバイトのデータを返すはず
+	auto decompressedSize = m_decompression_dictionary
+		? Helpers::Compress::ZStdDecompress(
+			Helpers::Compress::GetThreadLocalZStdDecompressionContext(),
+			m_decompression_dictionary.get(), stored, dest.first(m_chunk_size))
+		: Helpers::Compress::ZStdDecompress(stored, dest.first(m_chunk_size));
+	if (decompressedSize != m_chunk_size) {
+		throw Exceptions::FileError("Invalid data chunk size.");
+	}
+}
+
+std::span<const uint8_t> ArchiveLoader::m_readStoredChunks(size_t first, size_t last, std::vector<uint8_t>& buffer) const {
+	if (last > m_data_chunk_ranges.size() || first >= last) {
+		throw Exceptions::FileError("Data chunk index out of range.");
+	}
+
+	const uint64_t begin = m_data_chunk_ranges[first].first;
+	const uint64_t end = m_data_chunk_ranges[last - 1].first + m_data_chunk_ranges[last - 1].second;
+	return m_viewData(end - begin, m_data_start_position + begin, buffer);
+}
+
+std::vector<uint8_t>& ArchiveLoader::m_getThreadLocalReadBuffer() {
+	thread_local std::vector<uint8_t> buffer;
+	return buffer;
+}
+
+std::shared_ptr<PameECS::File::Archive::IReadBackend> ArchiveLoader::m_createReadBackend(const std::filesystem::path& path, const Properties& properties) {
+	switch (properties.readBackend.value_or(ReadBackend::Mapped)) {
+	case ReadBackend::Mapped:
+		return std::make_shared<MappedReadBackend>(path);
+	case ReadBackend::Positional:
+		return std::make_shared<PositionalReadBackend>(path);
+	}
+
+	throw Exceptions::InvalidArgument("Unknown read backend.");
 }
 
 void ArchiveLoader::m_loadAndVerifyHeader() {
-	const std::array<std::array<uint8_t, 3>, 1> expectedVersions = {
+	const std::array<std::array<uint8_t, 3>, 5> expectedVersions = {{
 		{1, 0, 0},
-	};
+		{1, 1, 0},
+		{1, 2, 0},
+		{1, 3, 0},
+		{1, 4, 0},
+	}};
 
 	Types::Header header;
 	m_readData(&header, sizeof(Types::Header));
@@ -116,6 +551,16 @@ void ArchiveLoader::m_loadAndVerifyHeader() {
 	if (!isVersionValid) {
 		throw Exceptions::FileError("Unsupported archive version.");
 	}
+
+	m_header = header;
+
+	if (m_hasChunkSizeExponent()) {
+		if (m_header.chunkSizeExponent < Types::minChunkSizeExponent
+			|| m_header.chunkSizeExponent > Types::maxChunkSizeExponent) {
+			throw Exceptions::FileError("Invalid data chunk size.");
+		}
+		m_chunk_size = size_t{ 1 } << m_header.chunkSizeExponent;
+	}
 }
 
 void ArchiveLoader::m_loadSizeInformationFromLastRead() {
@@ -124,56 +569,147 @@ void ArchiveLoader::m_loadSizeInformationFromLastRead() {
 	m_logger->debug(m_size_info.GenerateDebugString());
 }
 
-void ArchiveLoader::m_constructEntries(const std::vector<uint8_t>& data, size_t& readPosition) {
-	auto entryData
-		= std::vector<uint8_t>(
-			data.begin() + readPosition,
-			data.begin() + readPosition + m_size_info.entryCompressedSize);
+void ArchiveLoader::m_loadDictionaryInformationFromLastRead() {
+	m_readData(&m_dictionary_info, sizeof(Types::DictionaryInformation));
+	m_dictionary_info.ToNativeEndian();
+	m_logger->debug(m_dictionary_info.GenerateDebugString());
+}
 
+void ArchiveLoader::m_constructEntries(std::span<const uint8_t> data, size_t& readPosition) {
+	auto entryData = data.subspan(readPosition, m_size_info.entryCompressedSize);
 	readPosition += m_size_info.entryCompressedSize;
 
 	auto decompressed = Helpers::Compress::ZStdDecompress(entryData, m_size_info.entryUncompressedSize);
 
 	size_t decompressedReadPosition = 0;
 
-	m_constructEntries(decompressed, m_entries, m_virtual_root_entry_indexes, decompressedReadPosition);
+	m_root_entry_count = m_readEntryCount(decompressed, decompressedReadPosition);
+
+	// ディスク上の順番(行きがけ順)のエントリが、m_entriesのどこに置かれたか
+	std::vector<uint32_t> preorderIndexes;
+	m_constructEntries(decompressed, decompressedReadPosition, m_root_entry_count, 0, 0, preorderIndexes);
+
+	m_entry_path_hashes.resize(m_entries.size());
+
+	size_t hashIndexCount = 0;
+	if (m_hasWideEntryCounts()) {
+		hashIndexCount = m_readEntryCount(decompressed, decompressedReadPosition);
+	}
+
+	if (hashIndexCount != 0) {
+		// 書き込み時に計算済みのハッシュがあれば、全てのパスをハッシュし直さずに済む
+		if (hashIndexCount != m_entries.size()) {
+			throw Exceptions::FileError("Invalid entry hash index size.");
+		}
+
+		for (size_t i = 0; i < hashIndexCount; ++i) {
+			uint64_t hash = 0;
+			m_readData(&hash, decompressed.data(), sizeof(hash), decompressedReadPosition, decompressed.size());
+			decompressedReadPosition += sizeof(hash);
+			m_entry_path_hashes[preorderIndexes[i]] = m_toNativeEndian(hash);
+		}
+	}
+	else {
+		for (size_t i = 0; i < m_entries.size(); ++i) {
+			m_entry_path_hashes[i] = Helpers::Hash::Fnv1a64(GetPath(m_entries[i]));
+		}
+	}
+
+	m_constructEntryHashTable();
 }
 
-void ArchiveLoader::m_constructEntries(
-	const std::vector<uint8_t>& data,
-	std::vector<Types::Entry>& entries,
-	std::unordered_map<std::string, EntryIndex>& entryIndexes,
-	size_t& readPosition) {
-	auto read = [this, &data, &readPosition]<typename T>(T* dest, size_t size = sizeof(T)) {
+uint32_t ArchiveLoader::m_constructEntries(
+	std::span<const uint8_t> data,
+	size_t& readPosition,
+	size_t count,
+	uint64_t parentPathOffset,
+	uint32_t parentPathLength,
+	std::vector<uint32_t>& preorderIndexes) {
+	auto read = [this, &data, &readPosition](void* dest, size_t size) {
 		m_readData(dest, data.data(), size, readPosition, data.size());
 		readPosition += size;
 	};
 
-	// 実際は各エントリの最後の要素だけど、全体的に見ると先頭にはルート直下エントリの要素があるからこれでいいはず
-	uint16_t entryCount = 0;
-	read(&entryCount);
+	const size_t first = m_entries.size();
+	// ハッシュ表ではインデックス + 1を使うので、最大値は使えない
+	if (first + count >= std::numeric_limits<uint32_t>::max()) {
+		throw Exceptions::FileError("Too many entries in the archive.");
+	}
+	m_entries.resize(first + count);
+
+	for (size_t i = 0; i < count; ++i) {
+		preorderIndexes.emplace_back(static_cast<uint32_t>(first + i));
+
+		Types::Entry entry;
+		uint16_t nameLength = 0;
+		read(&entry.dataSize, sizeof(entry.dataSize));
+		read(&entry.dataOffset, sizeof(entry.dataOffset));
+		read(&nameLength, sizeof(nameLength));
+		entry.dataSize = m_toNativeEndian(entry.dataSize);
+		entry.dataOffset = m_toNativeEndian(entry.dataOffset);
+		entry.nameLength = m_toNativeEndian(nameLength);
+
+		// パスは"親のパス/名前"の形でブロブの末尾に追加する
+		const uint32_t separatorLength = parentPathLength > 0 ? 1 : 0;
+		entry.pathOffset = m_path_blob.size();
+		entry.pathLength = parentPathLength + separatorLength + entry.nameLength;
+		m_path_blob.resize(m_path_blob.size() + entry.pathLength);
+
+		char* path = m_path_blob.data() + entry.pathOffset;
+		std::memcpy(path, m_path_blob.data() + parentPathOffset, parentPathLength);
+		if (separatorLength > 0) {
+			path[parentPathLength] = '/';
+		}
+		read(path + parentPathLength + separatorLength, entry.nameLength);
 
-	for (size_t i = 0; i < entryCount; ++i) {
-		Types::Entry entry = {};
-		read(&entry.dataSize);
-		read(&entry.dataOffset);
-		read(&entry.nameLength);
+		entry.childCount = static_cast<uint32_t>(m_readEntryCount(data, readPosition));
+		entry.firstChild = m_constructEntries(data, readPosition, entry.childCount, entry.pathOffset, entry.pathLength, preorderIndexes);
+		entry.descendantCount = static_cast<uint32_t>(m_entries.size() - entry.firstChild);
 
-		entry.ToNativeEndian();
-		entry.name.resize(entry.nameLength);
-		read(entry.name.data(), entry.name.size());
+		// 再帰の中でm_entriesが再確保されるので、最後に書き込む
+		m_entries[first + i] = entry;
+	}
 
-		entryIndexes[entry.name].index = static_cast<uint16_t>(i);
+	return static_cast<uint32_t>(first);
+}
 
-		m_constructEntries(data, entry.children, entryIndexes[entry.name].children, readPosition);
+size_t ArchiveLoader::m_readEntryCount(std::span<const uint8_t> data, size_t& readPosition) {
+	if (m_hasWideEntryCounts()) {
+		uint32_t count = 0;
+		m_readData(&count, data.data(), sizeof(count), readPosition, data.size());
+		readPosition += sizeof(count);
+		return m_toNativeEndian(count);
 	}
+
+	uint16_t count = 0;
+	m_readData(&count, data.data(), sizeof(count), readPosition, data.size());
+	readPosition += sizeof(count);
+	return m_toNativeEndian(count);
 }
 
-void ArchiveLoader::m_loadDataChunkRanges(const std::vector<uint8_t>& data, size_t& readPosition) {
-	auto compressedDataChunkIndexData
-		= std::vector<uint8_t>(
-			data.begin() + readPosition,
-			data.begin() + readPosition + m_size_info.dataChunkIndexCompressedSize);
+void ArchiveLoader::m_constructEntryHashTable() {
+	// 負荷率を1/2以下に抑えて、探索が短く済むようにする
+	m_entry_hash_table.assign(std::bit_ceil(std::max<size_t>(1, m_entries.size() * 2)), 0);
+	const size_t mask = m_entry_hash_table.size() - 1;
+
+	for (size_t i = 0; i < m_entries.size(); ++i) {
+		const uint64_t hash = m_entry_path_hashes[i];
+		size_t bucket = hash & mask;
+		while (m_entry_hash_table[bucket] != 0) {
+			// 同じパスのエントリが複数あれば、後のものを優先する
+			const uint32_t other = m_entry_hash_table[bucket] - 1;
+			if (m_entry_path_hashes[other] == hash && GetPath(m_entries[other]) == GetPath(m_entries[i])) {
+				break;
+			}
+			bucket = (bucket + 1) & mask;
+		}
+
+		m_entry_hash_table[bucket] = static_cast<uint32_t>(i + 1);
+	}
+}
+
+void ArchiveLoader::m_loadDataChunkRanges(std::span<const uint8_t> data, size_t& readPosition) {
+	auto compressedDataChunkIndexData = data.subspan(readPosition, m_size_info.dataChunkIndexCompressedSize);
 	readPosition += m_size_info.dataChunkIndexCompressedSize;
 
 	auto dataChunkIndexData
@@ -206,57 +742,143 @@ void ArchiveLoader::m_loadDataChunkRanges(const std::vector<uint8_t>& data, size
 	}
 }
 
-void ArchiveLoader::m_loadAndVerifyFooterFromLastRead(const std::vector<uint8_t>& checkTarget) {
-	uint64_t footer = 0;
-	m_readData(&footer, sizeof(uint64_t));
-	footer = m_toNativeEndian(footer);
-	Helpers::CRC::CRC64ECMACalculator crcCalculator;
-	auto calculated = crcCalculator.Calculate(checkTarget);
-	if (footer != calculated) {
-		throw Exceptions::FileError("Archive footer CRC64 verification failed.");
+void ArchiveLoader::m_loadDictionary(std::span<const uint8_t> data, size_t& readPosition) {
+	if (m_dictionary_info.dictionarySize == 0) {
+		return;
 	}
+
+	auto dictionary = data.subspan(readPosition, m_dictionary_info.dictionarySize);
+	readPosition += m_dictionary_info.dictionarySize;
+
+	// 解析はここで一度だけ行い、チャンク毎には辞書を読み直さない
+	m_decompression_dictionary = Helpers::Compress::CreateZStdDecompressionDictionary(dictionary);
 }
 
-std::vector<uint16_t> ArchiveLoader::m_pathVectorToIndexVector(
-	const std::vector<std::string>& path,
-	const std::unordered_map<std::string, EntryIndex>& indexMap) const {
-	const auto* currentIndexMap = &indexMap;
-	std::vector<uint16_t> result;
-	for (size_t i = 0; i < path.size(); ++i) {
-		auto it = currentIndexMap->find(path[i]);
-		if (it == currentIndexMap->end()) {
-			return {};
+void ArchiveLoader::m_markStoredEntries() {
+	// 無圧縮のチャンク数の累積和があれば、ファイル毎にチャンクを数え直さずに済む
+	std::vector<size_t> rawChunkCounts(m_data_chunk_ranges.size() + 1, 0);
+	for (size_t i = 0; i < m_data_chunk_ranges.size(); ++i) {
+		rawChunkCounts[i + 1] = rawChunkCounts[i] + (m_isRawChunk(i) ? 1 : 0);
+	}
+
+	for (auto& entry : m_entries) {
+		if (!IsFile(entry)) {
+			continue;
 		}
 
-		result.emplace_back(it->second.index);
-		currentIndexMap = &it->second.children;
-	}
+		const uint64_t start = entry.dataOffset / m_chunk_size;
+		const uint64_t end = (entry.dataOffset + entry.dataSize - 1) / m_chunk_size + 1;
+		// 範囲外のエントリは、読み込み時にエラーにする
+		if (end > m_data_chunk_ranges.size() || end <= start) {
+			continue;
+		}
 
-	return result;
+		entry.isStored = rawChunkCounts[end] - rawChunkCounts[start] == end - start;
+	}
 }
 
-bool ArchiveLoader::m_isExist(const std::vector<std::string>& path) const {
-	return !m_pathVectorToIndexVector(path, m_virtual_root_entry_indexes).empty();
+void ArchiveLoader::m_loadAndVerifyFooterFromLastRead(uint64_t position, uint64_t size, VerificationPolicy policy) {
+	uint64_t footer = 0;
+	m_readData(&footer, sizeof(uint64_t));
+	footer = m_toNativeEndian(footer);
+
+	switch (policy) {
+	case VerificationPolicy::Eager:
+		m_verifyAsync(position, size, footer).get();
+		break;
+	case VerificationPolicy::Background:
+		m_verification = m_verifyAsync(position, size, footer).share();
+		return;
+	case VerificationPolicy::Trusted:
+		break;
+	}
+
+	std::promise<void> completed;
+	completed.set_value();
+	m_verification = completed.get_future().share();
 }
 
+std::future<void> ArchiveLoader::m_verifyAsync(uint64_t position, uint64_t size, uint64_t expected) const {
+	using Helpers::CRC::CRC64ECMACalculator;
 
-PameECS::File::Archive::Types::Entry ArchiveLoader::m_getEntry(const std::vector<std::string>& path) const {
-	auto indexPath = m_pathVectorToIndexVector(path, m_virtual_root_entry_indexes);
-	if (indexPath.empty()) {
-		throw Exceptions::FileError("No entry found for the given path.");
+	if (!m_canRead(m_backend->GetSize(), size, position)) {
+		throw Exceptions::FileError("Attempted to read beyond the end of the archive file.");
 	}
 
-	try {
-		const Types::Entry* currentEntry = &m_entries.at(indexPath[0]);
-		for (size_t i = 1; i < indexPath.size(); ++i) {
-			currentEntry = &currentEntry->children.at(indexPath[i]);
+	const size_t segmentCount = std::clamp<size_t>(
+		size / m_min_crc_segment_bytes, 1, m_thread_pool->get_thread_count());
+
+	// 区間毎に並列でCRCを取り、最後に順番に結合する
+	const BS::blocks<size_t> segments(0, size, segmentCount);
+	auto crcs = std::make_shared<std::vector<uint64_t>>(segments.get_num_blocks());
+
+	return Thread::DetachBlocksAsync(
+		*m_thread_pool, size_t{ 0 }, crcs->size(),
+		// ローダーが先に破棄されても、検証が終わるまではバックエンドを保持する
+		[backend = m_backend, mapped = m_mapped_data, position, segments, crcs](const size_t blockBegin, const size_t blockEnd) {
+			for (size_t i = blockBegin; i < blockEnd; ++i) {
+				const uint64_t segmentBegin = position + segments.start(i);
+				const uint64_t segmentSize = segments.end(i) - segments.start(i);
+				if (!mapped.empty()) {
+					(*crcs)[i] = CRC64ECMACalculator().Calculate(mapped.subspan(segmentBegin, segmentSize));
+					continue;
+				}
+
+				// マップされていなければ、区間を少しずつ読みながらCRCを更新する
+				CRC64ECMACalculator calculator;
+				std::vector<uint8_t> buffer(std::min<uint64_t>(segmentSize, m_crc_read_bytes));
+				for (uint64_t done = 0; done < segmentSize; done += buffer.size()) {
+					const size_t bytes = static_cast<size_t>(std::min<uint64_t>(buffer.size(), segmentSize - done));
+					const IReadBackend::ReadRequest request = { segmentBegin + done, std::span(buffer).first(bytes) };
+					backend->Read(std::span(&request, 1));
+					calculator.Update(request.dest);
+				}
+				(*crcs)[i] = calculator.GetValue();
+			}
+		},
+		1,
+		[segments, crcs, expected]() {
+			uint64_t crc = CRC64ECMACalculator::initialValue;
+			for (size_t i = 0; i < crcs->size(); ++i) {
+				crc = CRC64ECMACalculator::Combine(crc, (*crcs)[i], segments.end(i) - segments.start(i));
+			}
+
+			if (crc != expected) {
+				throw Exceptions::FileError("Archive footer CRC64 verification failed.");
+			}
 		}
+	);
+}
+
+const PameECS::File::Archive::Types::Entry& ArchiveLoader::GetEntry(std::string_view virtualPath) const {
+	const Types::Entry* entry = m_findEntry(virtualPath);
+	if (!entry) {
+		throw Exceptions::FileError("No entry found for the given path.");
+	}
+
+	return *entry;
+}
 
-		// currentEntryがnullptrになるわけがないから、nullチェックは不要
-		return *currentEntry;
+const PameECS::File::Archive::Types::Entry* ArchiveLoader::m_findEntry(std::string_view virtualPath) const {
+	const Types::Entry* entry = m_findEntryByNormalizedPath(virtualPath);
+	if (!entry && !Helpers::Path::IsNormalizedVirtualPath(virtualPath)) {
+		// '\'区切りや連続した区切りが含まれている場合だけ、正規化してから探し直す
+		entry = m_findEntryByNormalizedPath(Helpers::Path::NormalizeVirtualPath(virtualPath));
 	}
-	catch (const std::out_of_range) {
-		// indexPathの元になるデータを生成するのはアーカイブのロード時なので、このエラーメッセージ
-		throw Exceptions::FileError("Invalid child index is generated during archive file is loaded.");
+
+	return entry;
+}
+
+const PameECS::File::Archive::Types::Entry* ArchiveLoader::m_findEntryByNormalizedPath(std::string_view virtualPath) const {
+	const uint64_t hash = Helpers::Hash::Fnv1a64(virtualPath);
+	const size_t mask = m_entry_hash_table.size() - 1;
+
+	for (size_t bucket = hash & mask; m_entry_hash_table[bucket] != 0; bucket = (bucket + 1) & mask) {
+		const uint32_t index = m_entry_hash_table[bucket] - 1;
+		if (m_entry_path_hashes[index] == hash && GetPath(m_entries[index]) == virtualPath) {
+			return &m_entries[index];
+		}
 	}
+
+	return nullptr;
 }
@@ -3,43 +3,160 @@
 #include <memory>
 #include <future>
 #include <vector>
+#include <span>
+#include <optional>
+#include <ranges>
+#include <string_view>
+#include <stop_token>
 #include <BS_thread_pool.hpp/BS_thread_pool.hpp>
-#include <boost/interprocess/file_mapping.hpp>
-#include <boost/interprocess/mapped_region.hpp>
 #include <spdlog/logger.h>
 
 #include "types.hpp"
-#include "../../helpers/path.hpp"
+#include "chunk_cache.hpp"
+#include "read_backend_interface.hpp"
 #include "../../helpers/binary.hpp"
+#include "../../helpers/compress.hpp"
+#include "../../helpers/path.hpp"
+#include "../../thread/detach_blocks_async.hpp"
 #include "../../exceptions/file_error.hpp"
+#include "../../exceptions/invalid_argument.hpp"
 
 namespace PameECS::File::Archive {
 	class ArchiveLoader {
 	public:
-		ArchiveLoader(const std::filesystem::path& path, std::shared_ptr<BS::thread_pool<0U>> threadPool, std::shared_ptr<spdlog::logger> logger);
+		enum class VerificationPolicy {
+			Eager, // 構築時にCRCを検証し、失敗すればコンストラクタが例外を投げる
+			Background, // スレッドプールで検証し、結果はGetVerificationFutureで受け取る
+			Trusted, // 検証しない
+		};
+
+		enum class ReadBackend {
+			Mapped, // ファイル全体をメモリにマップする
+			Positional, // マップせず、必要なチャンクの範囲だけを読む、RAMより大きいアーカイブ向け
+		};
+
+		struct Properties {
+			// 展開済みチャンクのキャッシュの予算(バイト数)、nulloptであれば8MiBとチャンク4つ分の大きい方、0であればキャッシュしない
+			// チャンクサイズより小さければInvalidArgumentを投げる、シャード数は各シャードにチャンクが4つ収まるように減らす
+			std::optional<size_t> chunkCacheBytes;
+			// 1つのタスクで展開するチャンク数、nulloptであれば16、0は1として扱う
+			std::optional<size_t> chunksPerTask;
+			// アーカイブ全体のCRCをいつ検証するか、nulloptであればEager
+			std::optional<VerificationPolicy> verificationPolicy;
+			// 先読みの1つのタスクで処理するチャンク数、nulloptであれば8、0は1として扱う
+			std::optional<size_t> prefetchChunksPerTask;
+			// パスから開く場合の入出力の方法、nulloptであればMapped
+			std::optional<ReadBackend> readBackend;
+		};
+
+		// Prefetchの取り消しと完了待ち
+		struct PrefetchHandle {
+			std::stop_source stopSource;
+			// 取り消された場合も完了する、チャンクの展開に失敗していればget()で例外が投げられる
+			std::shared_future<void> completion;
+
+			void Cancel() noexcept {
+				stopSource.request_stop();
+			}
+		};
+
+		ArchiveLoader(
+			const std::filesystem::path& path,
+			std::shared_ptr<BS::thread_pool<0U>> threadPool,
+			std::shared_ptr<spdlog::logger> logger,
+			const Properties& properties = {});
+		// 独自の入出力の実装で開く、properties.readBackendは無視する
+		ArchiveLoader(
+			std::shared_ptr<IReadBackend> backend,
+			std::shared_ptr<BS::thread_pool<0U>> threadPool,
+			std::shared_ptr<spdlog::logger> logger,
+			const Properties& properties = {});
 		~ArchiveLoader() = default;
 		ArchiveLoader(const ArchiveLoader&) = delete;
 		ArchiveLoader& operator=(const ArchiveLoader&) = delete;
 		ArchiveLoader(ArchiveLoader&&) = default;
 		ArchiveLoader& operator=(ArchiveLoader&&) = default;
 
-		Types::Entry GetEntry(const std::string& virtualPath) const {
-			return m_getEntry(Helpers::Path::PathToVector(virtualPath));
-		}
+		// 返す参照はローダーが破棄されるまで有効
+		const Types::Entry& GetEntry(std::string_view virtualPath) const;
 
 		std::vector<uint8_t> GetFileData(const std::string& virtualPath) const {
-			GetFileData(GetEntry(virtualPath));
+			return GetFileData(GetEntry(virtualPath));
 		}
 		std::vector<uint8_t> GetFileData(const Types::Entry& entry) const {
-			GetFileDataAsync(entry).get();
+			return GetFileDataAsync(entry).get();
 		}
 		std::future<std::vector<uint8_t>> GetFileDataAsync(const std::string& virtualPath) const {
 			return GetFileDataAsync(GetEntry(virtualPath));
 		}
 		std::future<std::vector<uint8_t>> GetFileDataAsync(const Types::Entry& entry) const;
 
-		bool IsExist(const std::string& virtualPath) const {
-			return m_isExist(Helpers::Path::PathToVector(virtualPath));
+		// destに直接展開するので、余計なコピーが発生しない
+		// destはentry.dataSizeバイト以上で、futureが完了するまで有効であること
+		void GetFileData(const std::string& virtualPath, std::span<uint8_t> dest) const {
+			GetFileData(GetEntry(virtualPath), dest);
+		}
+		void GetFileData(const Types::Entry& entry, std::span<uint8_t> dest) const {
+			GetFileDataAsync(entry, dest).get();
+		}
+		std::future<void> GetFileDataAsync(const std::string& virtualPath, std::span<uint8_t> dest) const {
+			return GetFileDataAsync(GetEntry(virtualPath), dest);
+		}
+		std::future<void> GetFileDataAsync(const Types::Entry& entry, std::span<uint8_t> dest) const;
+
+		// ファイルの[offset, offset + length)だけを読み込む、範囲にかかるチャンクだけを展開する
+		// destはlengthバイト以上で、futureが完了するまで有効であること
+		void ReadRange(const Types::Entry& entry, uint64_t offset, uint64_t length, std::span<uint8_t> dest) const {
+			ReadRangeAsync(entry, offset, length, dest).get();
+		}
+		std::future<void> ReadRangeAsync(const std::string& virtualPath, uint64_t offset, uint64_t length, std::span<uint8_t> dest) const {
+			return ReadRangeAsync(GetEntry(virtualPath), offset, length, dest);
+		}
+		std::future<void> ReadRangeAsync(const Types::Entry& entry, uint64_t offset, uint64_t length, std::span<uint8_t> dest) const;
+
+		// 複数ファイルをまとめて読み込む、結果はvirtualPathsと同じ順番
+		// 複数のファイルにまたがるチャンクも一度しか展開しない
+		std::vector<std::vector<uint8_t>> GetFilesData(std::span<const std::string> virtualPaths) const {
+			return GetFilesDataAsync(virtualPaths).get();
+		}
+		std::future<std::vector<std::vector<uint8_t>>> GetFilesDataAsync(std::span<const std::string> virtualPaths) const;
+
+		bool IsExist(std::string_view virtualPath) const {
+			return m_findEntry(virtualPath) != nullptr;
+		}
+
+		// 仮想ルートからの、'/'区切りのパス
+		std::string_view GetPath(const Types::Entry& entry) const {
+			return { m_path_blob.data() + entry.pathOffset, entry.pathLength };
+		}
+		std::string_view GetName(const Types::Entry& entry) const {
+			return GetPath(entry).substr(entry.pathLength - entry.nameLength);
+		}
+		std::span<const Types::Entry> GetChildren(const Types::Entry& entry) const {
+			return std::span<const Types::Entry>(m_entries).subspan(entry.firstChild, entry.childCount);
+		}
+		std::span<const Types::Entry> GetRootEntries() const {
+			return std::span<const Types::Entry>(m_entries).first(m_root_entry_count);
+		}
+		// ディレクトリ直下のエントリ、空のパスであれば仮想ルート直下
+		std::span<const Types::Entry> GetDirectoryEntries(std::string_view virtualPath) const;
+		// ディレクトリ以下の全てのエントリ、兄弟毎にまとまって並ぶが行きがけ順ではない
+		std::span<const Types::Entry> GetDescendants(const Types::Entry& entry) const {
+			return std::span<const Types::Entry>(m_entries).subspan(entry.firstChild, entry.descendantCount);
+		}
+		// 空のパスであれば全てのエントリ
+		std::span<const Types::Entry> GetDescendants(std::string_view virtualPath) const;
+		// パスがパターンに一致するエントリ(ディレクトリも含む)を、エントリの表を走査しながら列挙する
+		// 書式はHelpers::Path::MatchGlobに従い、パスと同じく'\'区切りや先頭と連続した'/'は正規化してから比べる
+		// 正規化が必要な場合だけ正規化したパターンをビューが持ち、それ以外はpatternを参照するので列挙が終わるまで有効であること
+		// ワイルドカードより前のディレクトリが決まっていれば、その中だけを探す
+		auto Glob(std::string_view pattern) const {
+			const bool isNormalized = Helpers::Path::IsNormalizedVirtualPath(pattern);
+			std::string normalized = isNormalized ? std::string() : Helpers::Path::NormalizeVirtualPath(pattern);
+			const auto searchRange = m_getGlobSearchRange(isNormalized ? pattern : std::string_view(normalized));
+			return searchRange | std::views::filter([this, isNormalized, pattern, normalized = std::move(normalized)](const Types::Entry& entry) {
+				return Helpers::Path::MatchGlob(isNormalized ? pattern : std::string_view(normalized), GetPath(entry));
+			});
 		}
 
 		bool IsFile(const Types::Entry& entry) const {
@@ -48,9 +165,50 @@ namespace PameECS::File::Archive {
 		bool IsDirectory(const Types::Entry& entry) const {
 			return !IsFile(entry);
 		}
+
+		// 無圧縮で格納されたファイルであれば、コピーせずにマップされた領域を直接参照できる
+		bool IsStored(const Types::Entry& entry) const {
+			return entry.isStored;
+		}
+		// 戻り値はローダーが破棄されるまで有効、IsStoredでないエントリではInvalidArgumentを投げる
+		// ファイルがマップされていなければ、InvalidOperationを投げる
+		std::span<const uint8_t> GetStoredFileData(std::string_view virtualPath) const {
+			return GetStoredFileData(GetEntry(virtualPath));
+		}
+		std::span<const uint8_t> GetStoredFileData(const Types::Entry& entry) const;
+
+		// データチャンク1つの展開後のサイズ
+		size_t GetChunkSize() const noexcept {
+			return m_chunk_size;
+		}
+
+		// ファイル、またはディレクトリ以下の全てのファイルのデータを、バックグラウンドで先読みしてチャンクキャッシュに展開しておく
+		// マップされていなければ、無圧縮のチャンクはOSのファイルキャッシュに読み込むだけになる
+		// 先読みはスレッドプールのワーカーを同時に1つしか使わず、タスク毎にキューの末尾に並び直すので、通常の読み込みを妨げない
+		// キャッシュの予算を超える分は、先に展開したものから追い出される
+		// ローダーを破棄する前に、Cancelしてcompletionを待つこと
+		PrefetchHandle Prefetch(std::string_view virtualPath) const {
+			return Prefetch(std::span<const std::string_view>(&virtualPath, 1));
+		}
+		PrefetchHandle Prefetch(std::span<const std::string_view> virtualPaths) const;
+		PrefetchHandle Prefetch(std::span<const std::string> virtualPaths) const {
+			std::vector<std::string_view> views(virtualPaths.begin(), virtualPaths.end());
+			return Prefetch(std::span<const std::string_view>(views));
+		}
+
+		// 検証に失敗していれば、get()でFileErrorが投げられる
+		// Background以外では構築時点で完了している
+		std::shared_future<void> GetVerificationFuture() const {
+			return m_verification;
+		}
+
+		// キャッシュが無効であれば全て0
+		ChunkCache::Statistics GetChunkCacheStatistics() const {
+			return m_chunk_cache ? m_chunk_cache->GetStatistics() : ChunkCache::Statistics{};
+		}
 	private:
 		bool m_canRead(const size_t sourceSize, const size_t bytes, const size_t position) const noexcept {
-			return position + bytes <= sourceSize;
+			return position <= sourceSize && bytes <= sourceSize - position;
 		}
 
 		void m_readData(void* dest, const void* source, const size_t bytes, const size_t position, const size_t sourceSize) const {
@@ -61,7 +219,22 @@ namespace PameECS::File::Archive {
 		}
 
 		void m_readData(void* buffer, const size_t bytes, const size_t position) const {
-			m_readData(buffer, m_file_view.get_address(), bytes, position, m_file_view.get_size());
+			const IReadBackend::ReadRequest request = { position, { static_cast<uint8_t*>(buffer), bytes } };
+			m_backend->Read(std::span(&request, 1));
+		}
+
+		// マップされていればコピーせずに参照し、そうでなければbufferに読み込んで返す
+		std::span<const uint8_t> m_viewData(const size_t bytes, const size_t position, std::vector<uint8_t>& buffer) const {
+			if (!m_mapped_data.empty()) {
+				if (!m_canRead(m_mapped_data.size(), bytes, position)) {
+					throw Exceptions::FileError("Attempted to read beyond the end of the mapped file.");
+				}
+				return m_mapped_data.subspan(position, bytes);
+			}
+
+			buffer.resize(bytes);
+			m_readData(buffer.data(), bytes, position);
+			return buffer;
 		}
 
 		void m_readData(void* buffer, const size_t bytes) {
@@ -74,42 +247,143 @@ namespace PameECS::File::Archive {
 			return Helpers::Binary::ToNativeEndian<T, std::endian::little>(value);
 		}
 			
-		struct EntryIndex {
-			uint16_t index = 0; // エントリのインデックス
-			std::unordered_map<std::string, EntryIndex> children; // 子エントリのインデックス
+		inline static constexpr size_t m_default_chunk_cache_bytes = 8 * 1024 * 1024;
+		// キャッシュの各シャードに最低限収まるチャンク数、大きいチャンクでもシャードの予算で弾かれないようにする
+		inline static constexpr size_t m_min_cached_chunks_per_shard = 4;
+		inline static constexpr size_t m_default_chunks_per_task = 16;
+		inline static constexpr size_t m_default_prefetch_chunks_per_task = 8;
+		// 先読みを頼めずにページインする際に触る間隔、実際のページサイズより小さければ無駄に触るだけで問題はない
+		inline static constexpr size_t m_page_size = 4096;
+		// これより小さい区間に分けてCRCを並列に取っても、タスクの受け渡しの方が高くつく
+		inline static constexpr size_t m_min_crc_segment_bytes = 4 * 1024 * 1024;
+		// マップされていない場合に、CRCを取るために一度に読む量
+		inline static constexpr size_t m_crc_read_bytes = 1024 * 1024;
+
+		static std::shared_ptr<IReadBackend> m_createReadBackend(const std::filesystem::path& path, const Properties& properties);
+
+		void m_validateFileDestination(const Types::Entry& entry, std::span<const uint8_t> dest) const;
+		// 展開後のデータ全体における[rangeOffset, rangeOffset + dest.size())のうち、チャンクに含まれる部分をdestに書き込む
+		// storedは格納されたままのチャンク、空であれば必要になった時に読む
+		void m_readChunk(size_t chunkIndex, uint64_t rangeOffset, std::span<uint8_t> dest, std::span<const uint8_t> stored = {}) const;
+		// m_readChunkのキャッシュを見ない部分、呼び出し側でキャッシュにないことを確かめておく
+		void m_readUncachedChunk(size_t chunkIndex, uint64_t rangeOffset, std::span<uint8_t> dest, std::span<const uint8_t> stored = {}) const;
+		// [first, last)のチャンクをm_readChunkと同様に書き込む
+		// キャッシュにあるチャンクは読まず、キャッシュにないチャンクが連続する範囲だけをまとめて読む
+		void m_readChunks(size_t first, size_t last, uint64_t rangeOffset, std::span<uint8_t> dest) const;
+		// 無圧縮のチャンクはキャッシュに入れないので、探さずにnullptrを返す
+		ChunkCache::ChunkData m_findCachedChunk(size_t chunkIndex) const {
+			return m_chunk_cache && !m_isRawChunk(chunkIndex) ? m_chunk_cache->Find(chunkIndex) : nullptr;
+		}
+		void m_copyChunkData(size_t chunkIndex, std::span<const uint8_t> chunkData, uint64_t rangeOffset, std::span<uint8_t> dest) const;
+		// キャッシュにあればそれを返し、なければ展開してキャッシュに入れる
+		ChunkCache::ChunkData m_getChunkData(size_t chunkIndex, std::span<const uint8_t> stored = {}) const;
+		void m_decompressChunk(size_t chunkIndex, std::span<const uint8_t> stored, std::span<uint8_t> dest) const;
+		// [first, last)のチャンクは連続して格納されているので、1回の読み込みでまとめて読む
+		std::span<const uint8_t> m_readStoredChunks(size_t first, size_t last, std::vector<uint8_t>& buffer) const;
+		// m_readStoredChunks(first, ...)の戻り値から、chunkIndex番目のチャンクを切り出す
+		std::span<const uint8_t> m_sliceStoredChunk(std::span<const uint8_t> storedChunks, size_t first, size_t chunkIndex) const {
+			const auto& [offset, size] = m_data_chunk_ranges[chunkIndex];
+			return storedChunks.subspan(offset - m_data_chunk_ranges[first].first, size);
+		}
+		// タスクをまたいで使い回す読み込み用のバッファ、大きさはワーカー毎に1タスク分で収まる
+		static std::vector<uint8_t>& m_getThreadLocalReadBuffer();
+
+		struct PrefetchState {
+			std::vector<size_t> chunkIndexes;
+			size_t next = 0; // 先読みのタスクは同時に1つしか走らないので、排他は不要
+			std::stop_token stopToken;
+			std::promise<void> completion;
 		};
 
-		inline static constexpr size_t m_chunk_size = 2048;
+		void m_collectPrefetchChunks(const Types::Entry& entry, std::vector<size_t>& chunkIndexes) const;
+		// stateの続きを処理するタスクを、スレッドプールのキューの末尾に積む
+		void m_schedulePrefetch(std::shared_ptr<PrefetchState> state) const;
+		void m_prefetchChunk(size_t chunkIndex) const;
+		// マップされた領域の先読みをOSに頼む、頼めなければ各ページを読んでページインしておく
+		static void m_prefetchPages(std::span<const uint8_t> data);
+
+		// 範囲に含まれるチャンクをm_chunks_per_task個ずつのタスクで展開し、全て終わったらonCompleteの戻り値でfutureを完了する
+		template<typename OnComplete>
+		auto m_readRangeAsync(uint64_t rangeOffset, std::span<uint8_t> dest, OnComplete&& onComplete) const {
+			const size_t start = rangeOffset / m_chunk_size;
+			const size_t end = (rangeOffset + dest.size() - 1) / m_chunk_size + 1;
 
-		std::future<std::array<uint8_t, m_chunk_size>> m_getChunkDataAsync(size_t chunkIndex) const;
+			return Thread::DetachBlocksAsync(
+				*m_thread_pool, start, end,
+				[this, rangeOffset, dest](const size_t blockBegin, const size_t blockEnd) {
+					m_readChunks(blockBegin, blockEnd, rangeOffset, dest);
+				},
+				m_chunks_per_task,
+				std::forward<OnComplete>(onComplete));
+		}
 
-		void m_fileMap(const std::filesystem::path& path);
 		void m_loadAndVerifyHeader();
 		void m_loadSizeInformationFromLastRead();
-		void m_constructEntries(const std::vector<uint8_t>& data, size_t& readPosition);
-		void m_constructEntries(const std::vector<uint8_t>& data, std::vector<Types::Entry>& entries, std::unordered_map<std::string, EntryIndex>& entryIndexes, size_t& readPosition);
-		void m_loadDataChunkRanges(const std::vector<uint8_t>& data, size_t& readPosition);
-		void m_loadAndVerifyFooterFromLastRead(const std::vector<uint8_t>& checkTarget);
+		void m_loadDictionaryInformationFromLastRead();
+		void m_constructEntries(std::span<const uint8_t> data, size_t& readPosition);
+		// 兄弟のエントリcount個をm_entriesの末尾にまとめて確保して読み込み、その先頭のインデックスを返す
+		uint32_t m_constructEntries(std::span<const uint8_t> data, size_t& readPosition, size_t count, uint64_t parentPathOffset, uint32_t parentPathLength, std::vector<uint32_t>& preorderIndexes);
+		// 1.0は16ビット、1.1以降は32ビット
+		size_t m_readEntryCount(std::span<const uint8_t> data, size_t& readPosition);
+		bool m_hasWideEntryCounts() const noexcept {
+			return m_header.versionMinor >= 1;
+		}
+		// 1.2以降はヘッダーでチャンクサイズが指定される
+		bool m_hasChunkSizeExponent() const noexcept {
+			return m_header.versionMinor >= 2;
+		}
+		// 1.4以降は、データチャンクの圧縮に使った辞書を格納できる
+		bool m_hasDictionaryInformation() const noexcept {
+			return m_header.versionMinor >= 4;
+		}
+		// 1.3以降は、格納されたサイズがチャンクサイズと等しいチャンクは圧縮されていない
+		bool m_isRawChunk(size_t chunkIndex) const {
+			return m_header.versionMinor >= 3 && m_data_chunk_ranges.at(chunkIndex).second == m_chunk_size;
+		}
+		void m_constructEntryHashTable();
+		void m_loadDataChunkRanges(std::span<const uint8_t> data, size_t& readPosition);
+		void m_loadDictionary(std::span<const uint8_t> data, size_t& readPosition);
+		// 全てのチャンクが無圧縮のファイルにisStoredを付ける
+		void m_markStoredEntries();
+		// [position, position + size)がCRCの対象
+		void m_loadAndVerifyFooterFromLastRead(uint64_t position, uint64_t size, VerificationPolicy policy);
+		// スレッドプールで区間毎に並列にCRCを取り、expectedと一致しなければfutureにFileErrorを入れる
+		std::future<void> m_verifyAsync(uint64_t position, uint64_t size, uint64_t expected) const;
 
-		std::vector<uint16_t> m_pathVectorToIndexVector(
-			const std::vector<std::string>& path,
-			const std::unordered_map<std::string, EntryIndex>& indexMap) const;
-		bool m_isExist(const std::vector<std::string>& path) const;
-		Types::Entry m_getEntry(const std::vector<std::string>& path) const;
+		const Types::Entry* m_findEntry(std::string_view virtualPath) const;
+		// patternは正規化済みであること
+		std::span<const Types::Entry> m_getGlobSearchRange(std::string_view pattern) const;
+		const Types::Entry* m_findEntryByNormalizedPath(std::string_view virtualPath) const;
 
 		std::shared_ptr<BS::thread_pool<0U>> m_thread_pool;
+		std::unique_ptr<ChunkCache> m_chunk_cache;
+		size_t m_chunks_per_task = m_default_chunks_per_task;
+		size_t m_prefetch_chunks_per_task = m_default_prefetch_chunks_per_task;
 
+		Types::Header m_header = {};
+		size_t m_chunk_size = Types::defaultChunkSize;
 		Types::SizeInformation m_size_info;
-		std::unordered_map<std::string, EntryIndex> m_virtual_root_entry_indexes;
+		Types::DictionaryInformation m_dictionary_info = {};
+		// 全てのワーカースレッドで共有する、辞書がなければnullptr
+		Helpers::Compress::ZStdDecompressionDictionary m_decompression_dictionary;
 		std::vector<Types::Entry> m_entries;
+		size_t m_root_entry_count = 0;
+		// 全エントリのパスを連結したもの、ムーブしてもバッファが変わらないようにvectorにする
+		std::vector<char> m_path_blob;
+		// パスのハッシュによるオープンアドレス法の表、値はm_entriesのインデックス + 1で、0は空き
+		std::vector<uint32_t> m_entry_hash_table;
+		std::vector<uint64_t> m_entry_path_hashes; // m_entries[i]のパスのハッシュ
 		std::vector<std::pair<uint64_t, uint64_t>> m_data_chunk_ranges; // (offset, size)
 
 		uint64_t m_data_start_position = 0;
 
 		uint64_t m_last_read = 0;
 
-		boost::interprocess::file_mapping m_file_map;
-		boost::interprocess::mapped_region m_file_view;
+		// バックグラウンドの検証がローダーより長生きすることがあるので共有する
+		std::shared_ptr<IReadBackend> m_backend;
+		// マップされていなければ空
+		std::span<const uint8_t> m_mapped_data;
+		std::shared_future<void> m_verification;
 
 		std::shared_ptr<spdlog::logger> m_logger;
 	};
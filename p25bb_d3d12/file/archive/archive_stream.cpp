@@ -0,0 +1,134 @@
+#include "archive_stream.hpp"
+#include <algorithm>
+#include <cstring>
+#include "../../exceptions/invalid_argument.hpp"
+
+using PameECS::File::Archive::ArchiveStream;
+
+ArchiveStream::ArchiveStream(const ArchiveLoader& loader, const Types::Entry& entry, const Properties& properties)
+	: m_loader(loader), m_entry(entry) {
+	if (!m_loader.IsFile(m_entry)) {
+		throw Exceptions::InvalidArgument("The entry is not a file.");
+	}
+
+	// 読み込む範囲はアーカイブ内のチャンクの境界で区切るので、バッファはチャンク単位で確保する
+	const size_t chunkSize = m_loader.GetChunkSize();
+	const size_t bufferSize = std::max<size_t>(1, properties.bufferSize.value_or(m_default_buffer_size));
+	m_buffer_size = (bufferSize + chunkSize - 1) / chunkSize * chunkSize;
+
+	for (auto& buffer : m_buffers) {
+		buffer.data.resize(static_cast<size_t>(std::min<uint64_t>(m_buffer_size, GetSize())));
+	}
+}
+
+ArchiveStream::~ArchiveStream() {
+	m_waitAll();
+}
+
+size_t ArchiveStream::Read(std::span<uint8_t> dest) {
+	// 例外で抜けた場合に位置が進まないように、最後にまとめて更新する
+	uint64_t position = m_position;
+	size_t done = 0;
+
+	while (done < dest.size() && position < GetSize()) {
+		const Buffer& buffer = m_acquire(position);
+		const size_t offset = static_cast<size_t>(position - buffer.position);
+		const size_t bytes = std::min(dest.size() - done, buffer.size - offset);
+
+		std::memcpy(dest.data() + done, buffer.data.data() + offset, bytes);
+		done += bytes;
+		position += bytes;
+	}
+
+	m_position = position;
+	return done;
+}
+
+void ArchiveStream::Seek(uint64_t position) {
+	if (position > GetSize()) {
+		throw Exceptions::InvalidArgument("The position is beyond the end of the file.");
+	}
+
+	m_position = position;
+}
+
+ArchiveStream::Buffer& ArchiveStream::m_acquire(uint64_t position) {
+	Buffer& current = m_buffers[m_current];
+	Buffer& next = m_buffers[1 - m_current];
+
+	if (current.Contains(position)) {
+		m_wait(current);
+		return current;
+	}
+
+	if (next.Contains(position)) {
+		// 先読みしていた範囲に進んだので、読み終えた方のバッファでさらに次を先読みする
+		m_wait(next);
+		m_current = 1 - m_current;
+		const uint64_t following = next.position + next.size;
+		if (following < GetSize()) {
+			m_request(current, following);
+		}
+		return next;
+	}
+
+	// 先読みと関係ない位置に移動したので、positionを含むチャンクの先頭から読み直す
+	m_waitAll();
+	m_request(current, m_getChunkStart(position));
+	m_wait(current);
+	const uint64_t following = current.position + current.size;
+	if (following < GetSize()) {
+		m_request(next, following);
+	}
+	return current;
+}
+
+void ArchiveStream::m_request(Buffer& buffer, uint64_t position) {
+	if (buffer.pending.valid()) {
+		buffer.pending.wait();
+	}
+
+	// 読み込みを始められなかった場合に、古い範囲が残らないようにする
+	buffer.size = 0;
+	const size_t size = static_cast<size_t>(m_getRequestEnd(position) - position);
+	buffer.pending = m_loader.ReadRangeAsync(m_entry, position, size, buffer.data);
+	buffer.position = position;
+	buffer.size = size;
+}
+
+uint64_t ArchiveStream::m_getChunkStart(uint64_t position) const noexcept {
+	const uint64_t chunkSize = m_loader.GetChunkSize();
+	const uint64_t chunkStart = (m_entry.dataOffset + position) / chunkSize * chunkSize;
+	return chunkStart > m_entry.dataOffset ? chunkStart - m_entry.dataOffset : 0;
+}
+
+uint64_t ArchiveStream::m_getRequestEnd(uint64_t position) const noexcept {
+	// 終わりをチャンクの境界に揃えれば、次の範囲は境界から始まり、境界のチャンクを2回展開しない
+	// バッファサイズはチャンクサイズの倍数なので、揃えても範囲は空にならない
+	const uint64_t chunkSize = m_loader.GetChunkSize();
+	const uint64_t end = (m_entry.dataOffset + position + m_buffer_size) / chunkSize * chunkSize - m_entry.dataOffset;
+	return std::min(end, GetSize());
+}
+
+void ArchiveStream::m_wait(Buffer& buffer) {
+	if (!buffer.pending.valid()) {
+		return;
+	}
+
+	try {
+		buffer.pending.get();
+	}
+	catch (...) {
+		// 失敗した範囲は、次に必要になった時に読み直す
+		buffer.size = 0;
+		throw;
+	}
+}
+
+void ArchiveStream::m_waitAll() noexcept {
+	for (auto& buffer : m_buffers) {
+		if (buffer.pending.valid()) {
+			buffer.pending.wait();
+		}
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <future>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "archive_loader.hpp"
+
+namespace PameECS::File::Archive {
+	// アーカイブ内の1つのファイルを先頭から順に読むストリーム
+	// 2つのバッファを交互に使い、片方を読んでいる間に次の範囲をスレッドプールで展開しておく
+	// ファイル全体をメモリに置かずに済むので、音声のデコーダーなどに読ませる用途向け
+	// ローダーはストリームより長生きすること、1つのストリームを複数のスレッドから同時に使ってはいけない
+	class ArchiveStream {
+	public:
+		struct Properties {
+			// 1つのバッファのサイズ、nulloptであれば256KiB、チャンクサイズの倍数に切り上げる
+			std::optional<size_t> bufferSize;
+		};
+
+		ArchiveStream(const ArchiveLoader& loader, const Types::Entry& entry, const Properties& properties = {});
+		// 先読み中のタスクの完了を待つ
+		~ArchiveStream();
+		ArchiveStream(const ArchiveStream&) = delete;
+		ArchiveStream& operator=(const ArchiveStream&) = delete;
+		// 先読み中のタスクがバッファを指しているので、ムーブもできない
+		ArchiveStream(ArchiveStream&&) = delete;
+		ArchiveStream& operator=(ArchiveStream&&) = delete;
+
+		// 読んだバイト数を返す、ファイルの終端に達していれば0
+		// 展開に失敗していれば例外を投げ、位置は進まない
+		size_t Read(std::span<uint8_t> dest);
+		// ファイルの先頭からの位置に移動する、ファイルのサイズを超えていればInvalidArgumentを投げる
+		// 先読み済みの範囲外に移動すると、次のReadで読み直す
+		void Seek(uint64_t position);
+
+		uint64_t Tell() const noexcept {
+			return m_position;
+		}
+		uint64_t GetSize() const noexcept {
+			return m_entry.dataSize;
+		}
+		bool IsEnd() const noexcept {
+			return m_position >= GetSize();
+		}
+	private:
+		struct Buffer {
+			std::vector<uint8_t> data;
+			uint64_t position = 0; // ファイル内での開始位置
+			size_t size = 0; // 読み込んだ(読み込み中の)バイト数、0であれば空
+			std::future<void> pending;
+
+			bool Contains(uint64_t target) const noexcept {
+				return size > 0 && position <= target && target < position + size;
+			}
+		};
+
+		inline static constexpr size_t m_default_buffer_size = 256 * 1024;
+
+		// positionを含むバッファを読み込み完了の状態で返し、次の範囲の先読みを始める
+		Buffer& m_acquire(uint64_t position);
+		// bufferに、positionからバッファサイズ以内で最後のチャンクの境界までの読み込みを始める
+		void m_request(Buffer& buffer, uint64_t position);
+		// ファイル内の位置を含むチャンクの先頭の、ファイル内での位置(ファイルの先頭より前であれば0)
+		uint64_t m_getChunkStart(uint64_t position) const noexcept;
+		uint64_t m_getRequestEnd(uint64_t position) const noexcept;
+		static void m_wait(Buffer& buffer);
+		void m_waitAll() noexcept;
+
+		const ArchiveLoader& m_loader;
+		const Types::Entry& m_entry;
+		size_t m_buffer_size;
+		std::array<Buffer, 2> m_buffers;
+		size_t m_current = 0;
+		uint64_t m_position = 0;
+	};
+}
@@ -0,0 +1,417 @@
+#include "archive_writer.hpp"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include "../../helpers/binary.hpp"
+#include "../../helpers/compress.hpp"
+#include "../../helpers/crc.hpp"
+#include "../../helpers/hash.hpp"
+#include "../../exceptions/file_error.hpp"
+#include "../../exceptions/invalid_argument.hpp"
+
+using PameECS::File::Archive::ArchiveWriter;
+
+namespace {
+	template<typename T>
+	void AppendLittleEndian(std::vector<uint8_t>& dest, T value) {
+		value = PameECS::Helpers::Binary::FromNativeEndian<T, std::endian::little>(value);
+		const size_t oldSize = dest.size();
+		dest.resize(oldSize + sizeof(T));
+		std::memcpy(dest.data() + oldSize, &value, sizeof(T));
+	}
+}
+
+ArchiveWriter::ArchiveWriter(std::shared_ptr<BS::thread_pool<0U>> threadPool, const Properties& properties)
+	: m_thread_pool(threadPool) {
+	assert(m_thread_pool);
+
+	m_compression_level = properties.compressionLevel.value_or(m_default_compression_level);
+	m_version_minor = properties.versionMinor.value_or(m_default_version_minor);
+	if (m_version_minor > m_latest_version_minor) {
+		throw Exceptions::InvalidArgument("Unsupported archive version.");
+	}
+
+	m_chunk_size = properties.chunkSize.value_or(Types::defaultChunkSize);
+	if (m_hasChunkSizeExponent()) {
+		if (!std::has_single_bit(m_chunk_size)
+			|| m_chunk_size < (size_t{ 1 } << Types::minChunkSizeExponent)
+			|| m_chunk_size > (size_t{ 1 } << Types::maxChunkSizeExponent)) {
+			throw Exceptions::InvalidArgument("The chunk size must be a power of two between 512 bytes and 16 MiB.");
+		}
+	}
+	else if (m_chunk_size != Types::defaultChunkSize) {
+		throw Exceptions::InvalidArgument("A custom chunk size requires PEAC 1.2 or later.");
+	}
+	m_write_hash_index = properties.writeHashIndex.value_or(true);
+	m_align_files_to_chunks = properties.alignFilesToChunks.value_or(true);
+	m_stored_extensions = properties.storedExtensions.value_or(std::vector<std::string>{});
+	m_dictionary_size = properties.dictionarySize.value_or(0);
+	if (m_dictionary_size > 0 && !m_hasDictionaryInformation()) {
+		throw Exceptions::InvalidArgument("A compression dictionary requires PEAC 1.4 or later.");
+	}
+	if (m_dictionary_size > std::numeric_limits<uint32_t>::max()) {
+		throw Exceptions::InvalidArgument("The dictionary size is too large.");
+	}
+	m_chunks_per_task = std::max<size_t>(1, properties.chunksPerTask.value_or(m_default_chunks_per_task));
+}
+
+void ArchiveWriter::AddFile(std::string_view virtualPath, std::vector<uint8_t> data, Storage storage) {
+	if (data.empty()) {
+		throw Exceptions::InvalidArgument("An empty file cannot be stored in the archive.");
+	}
+	if (storage == Storage::Stored && !m_hasRawChunks()) {
+		throw Exceptions::InvalidArgument("Storing files without compression requires PEAC 1.3 or later.");
+	}
+
+	auto& node = m_getOrCreateNode(virtualPath, true);
+	node.data = std::move(data);
+	node.isStored = storage == Storage::Stored;
+}
+
+void ArchiveWriter::AddFile(std::string_view virtualPath, const std::filesystem::path& sourcePath, Storage storage) {
+	std::ifstream stream(sourcePath, std::ios::binary | std::ios::ate);
+	if (!stream) {
+		throw Exceptions::FileError("Failed to open the source file.");
+	}
+
+	std::vector<uint8_t> data(static_cast<size_t>(stream.tellg()));
+	stream.seekg(0);
+	stream.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+	if (!stream) {
+		throw Exceptions::FileError("Failed to read the source file.");
+	}
+
+	AddFile(virtualPath, std::move(data), storage);
+}
+
+void ArchiveWriter::AddDirectory(std::string_view virtualPath) {
+	m_getOrCreateNode(virtualPath, false);
+}
+
+void ArchiveWriter::AddDirectoryTree(const std::filesystem::path& sourceDirectory, std::string_view virtualPath) {
+	if (!virtualPath.empty()) {
+		AddDirectory(virtualPath);
+	}
+
+	for (const auto& entry : std::filesystem::recursive_directory_iterator(sourceDirectory)) {
+		// アーカイブ内のパスはUTF-8にする
+		const auto relative = entry.path().lexically_relative(sourceDirectory).generic_u8string();
+		std::string path(virtualPath);
+		if (!path.empty()) {
+			path += '/';
+		}
+		path.append(relative.begin(), relative.end());
+
+		if (entry.is_directory()) {
+			AddDirectory(path);
+		}
+		// 空のファイルはディレクトリと区別できないので入れない
+		else if (entry.is_regular_file() && entry.file_size() > 0) {
+			const auto u8Extension = entry.path().extension().generic_u8string();
+			const std::string extension(u8Extension.begin(), u8Extension.end());
+			const bool isStored = std::find(m_stored_extensions.begin(), m_stored_extensions.end(), extension) != m_stored_extensions.end();
+			AddFile(path, entry.path(), isStored ? Storage::Stored : Storage::Compressed);
+		}
+	}
+}
+
+void ArchiveWriter::Write(const std::filesystem::path& path) const {
+	std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+	if (!stream) {
+		throw Exceptions::FileError("Failed to open the archive file for writing.");
+	}
+
+	Write(stream);
+
+	stream.close();
+	if (!stream) {
+		throw Exceptions::FileError("Failed to write the archive file.");
+	}
+}
+
+void ArchiveWriter::Write(std::ostream& stream) const {
+	std::vector<uint8_t> entrySection;
+	std::vector<uint64_t> pathHashes;
+	std::vector<FileLayout> files;
+	uint64_t totalDataSize = 0;
+
+	m_writeEntryCount(m_root.children.size(), entrySection);
+	m_writeEntries(m_root, "", entrySection, pathHashes, files, totalDataSize);
+
+	if (m_hasWideEntryCounts()) {
+		if (m_write_hash_index) {
+			m_writeEntryCount(pathHashes.size(), entrySection);
+			for (uint64_t hash : pathHashes) {
+				AppendLittleEndian(entrySection, hash);
+			}
+		}
+		else {
+			m_writeEntryCount(0, entrySection);
+		}
+	}
+
+	if (entrySection.size() > std::numeric_limits<uint32_t>::max()) {
+		throw Exceptions::InvalidArgument("The entry section is too large.");
+	}
+
+	auto compressedEntrySection = Helpers::Compress::ZStdCompress(entrySection, m_compression_level);
+	if (compressedEntrySection.size() > std::numeric_limits<uint32_t>::max()) {
+		throw Exceptions::InvalidArgument("The entry section is too large.");
+	}
+
+	// データが空でも、ローダーはチャンクが1つ以上あることを要求する
+	const size_t chunkCount = std::max<size_t>(1, (totalDataSize + m_chunk_size - 1) / m_chunk_size);
+	std::vector<uint8_t> dictionary;
+	Helpers::Compress::ZStdCompressionDictionary compressionDictionary;
+	if (m_dictionary_size > 0) {
+		dictionary = m_trainDictionary(files, chunkCount);
+	}
+	if (!dictionary.empty()) {
+		compressionDictionary = Helpers::Compress::CreateZStdCompressionDictionary(dictionary, m_compression_level);
+	}
+	auto blocks = m_compressChunks(files, chunkCount, compressionDictionary.get());
+
+	std::vector<uint8_t> chunkIndex;
+	chunkIndex.reserve(chunkCount * sizeof(uint64_t));
+	uint64_t totalChunkCompressedSize = 0;
+	for (const auto& block : blocks) {
+		for (uint64_t size : block.sizes) {
+			AppendLittleEndian(chunkIndex, totalChunkCompressedSize);
+			totalChunkCompressedSize += size;
+		}
+	}
+	auto compressedChunkIndex = Helpers::Compress::ZStdCompress(chunkIndex, m_compression_level);
+
+	std::vector<uint8_t> header;
+	const uint8_t chunkSizeExponent = m_hasChunkSizeExponent() ? static_cast<uint8_t>(std::countr_zero(m_chunk_size)) : 0;
+	header.insert(header.end(), { 'P', 'E', 'A', 'C', 1, m_version_minor, 0, chunkSizeExponent });
+	AppendLittleEndian<uint32_t>(header, static_cast<uint32_t>(compressedEntrySection.size()));
+	AppendLittleEndian<uint32_t>(header, static_cast<uint32_t>(entrySection.size()));
+	AppendLittleEndian<uint64_t>(header, compressedChunkIndex.size());
+	AppendLittleEndian<uint64_t>(header, chunkIndex.size());
+	AppendLittleEndian<uint64_t>(header, totalChunkCompressedSize);
+	assert(header.size() == sizeof(Types::Header) + sizeof(Types::SizeInformation));
+	if (m_hasDictionaryInformation()) {
+		AppendLittleEndian<uint32_t>(header, static_cast<uint32_t>(dictionary.size()));
+		AppendLittleEndian<uint32_t>(header, 0);
+	}
+
+	stream.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+
+	// フッターのCRCは、書き込みながら求める
+	Helpers::CRC::CRC64ECMACalculator crcCalculator;
+	auto writeChecked = [&stream, &crcCalculator](std::span<const uint8_t> data) {
+		stream.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+		crcCalculator.Update(data);
+	};
+
+	writeChecked(compressedEntrySection);
+	writeChecked(compressedChunkIndex);
+	writeChecked(dictionary);
+	for (const auto& block : blocks) {
+		writeChecked(block.data);
+	}
+
+	std::vector<uint8_t> footer;
+	AppendLittleEndian(footer, crcCalculator.GetValue());
+	stream.write(reinterpret_cast<const char*>(footer.data()), static_cast<std::streamsize>(footer.size()));
+
+	if (!stream) {
+		throw Exceptions::FileError("Failed to write the archive.");
+	}
+}
+
+ArchiveWriter::Node& ArchiveWriter::m_getOrCreateNode(std::string_view virtualPath, bool isFile) {
+	Node* node = &m_root;
+	bool isCreated = false;
+
+	size_t partBegin = 0;
+	while (partBegin <= virtualPath.size()) {
+		size_t partEnd = virtualPath.find_first_of("/\\", partBegin);
+		if (partEnd == std::string_view::npos) {
+			partEnd = virtualPath.size();
+		}
+
+		if (partEnd > partBegin) {
+			const auto part = virtualPath.substr(partBegin, partEnd - partBegin);
+			if (part.size() > std::numeric_limits<uint16_t>::max()) {
+				throw Exceptions::InvalidArgument("The entry name is too long.");
+			}
+			if (node->isFile) {
+				throw Exceptions::InvalidArgument("A file cannot have child entries.");
+			}
+
+			auto it = node->children.find(part);
+			isCreated = it == node->children.end();
+			if (isCreated) {
+				it = node->children.emplace(std::string(part), Node{}).first;
+			}
+			node = &it->second;
+		}
+
+		partBegin = partEnd + 1;
+	}
+
+	if (node == &m_root) {
+		throw Exceptions::InvalidArgument("The virtual path is empty.");
+	}
+
+	if (isFile) {
+		if (!isCreated && !node->isFile) {
+			throw Exceptions::InvalidArgument("A directory already exists at the virtual path.");
+		}
+		node->isFile = true;
+	}
+	else if (node->isFile) {
+		throw Exceptions::InvalidArgument("A file already exists at the virtual path.");
+	}
+
+	return *node;
+}
+
+void ArchiveWriter::m_writeEntries(
+	const Node& node,
+	const std::string& parentPath,
+	std::vector<uint8_t>& dest,
+	std::vector<uint64_t>& pathHashes,
+	std::vector<FileLayout>& files,
+	uint64_t& dataSize) const {
+	for (const auto& [name, child] : node.children) {
+		const std::string path = parentPath.empty() ? name : parentPath + "/" + name;
+
+		if (child.isFile && child.isStored) {
+			// 前のファイルのチャンクまで無圧縮にならないように、チャンクの先頭から始める
+			dataSize = (dataSize + m_chunk_size - 1) / m_chunk_size * m_chunk_size;
+		}
+		else if (child.isFile && m_align_files_to_chunks) {
+			// 今の位置のままでは余分なチャンクにまたがる場合だけ、次のチャンクの先頭に送る
+			const uint64_t offsetInChunk = dataSize % m_chunk_size;
+			const uint64_t chunksFromHere = (offsetInChunk + child.data.size() + m_chunk_size - 1) / m_chunk_size;
+			const uint64_t chunksIfAligned = (child.data.size() + m_chunk_size - 1) / m_chunk_size;
+			if (offsetInChunk != 0 && chunksFromHere > chunksIfAligned) {
+				dataSize += m_chunk_size - offsetInChunk;
+			}
+		}
+
+		AppendLittleEndian<uint64_t>(dest, child.isFile ? child.data.size() : 0);
+		AppendLittleEndian<uint64_t>(dest, child.isFile ? dataSize : 0);
+		AppendLittleEndian<uint16_t>(dest, static_cast<uint16_t>(name.size()));
+		dest.insert(dest.end(), name.begin(), name.end());
+		m_writeEntryCount(child.children.size(), dest);
+
+		pathHashes.emplace_back(Helpers::Hash::Fnv1a64(path));
+
+		if (child.isFile) {
+			files.push_back({ dataSize, &child.data, child.isStored });
+			dataSize += child.data.size();
+		}
+		if (child.isStored) {
+			// 次のファイルも、最後のチャンクを共有しないようにする
+			dataSize = (dataSize + m_chunk_size - 1) / m_chunk_size * m_chunk_size;
+		}
+
+		m_writeEntries(child, path, dest, pathHashes, files, dataSize);
+	}
+}
+
+void ArchiveWriter::m_writeEntryCount(size_t count, std::vector<uint8_t>& dest) const {
+	if (m_hasWideEntryCounts()) {
+		if (count > std::numeric_limits<uint32_t>::max()) {
+			throw Exceptions::InvalidArgument("Too many entries in a directory.");
+		}
+		AppendLittleEndian<uint32_t>(dest, static_cast<uint32_t>(count));
+		return;
+	}
+
+	if (count > std::numeric_limits<uint16_t>::max()) {
+		throw Exceptions::InvalidArgument("Too many entries in a directory for PEAC 1.0.");
+	}
+	AppendLittleEndian<uint16_t>(dest, static_cast<uint16_t>(count));
+}
+
+bool ArchiveWriter::m_fillChunk(size_t chunkIndex, std::span<const FileLayout> files, std::span<uint8_t> dest) const {
+	const uint64_t chunkBegin = static_cast<uint64_t>(chunkIndex) * m_chunk_size;
+	const uint64_t chunkEnd = chunkBegin + m_chunk_size;
+
+	// ファイルの間の隙間や最後のチャンクの余りは0で埋める
+	std::fill(dest.begin(), dest.end(), uint8_t{ 0 });
+
+	auto file = std::partition_point(files.begin(), files.end(), [chunkBegin](const FileLayout& layout) {
+		return layout.offset + layout.data->size() <= chunkBegin;
+	});
+
+	bool containsStored = false;
+	for (; file != files.end() && file->offset < chunkEnd; ++file) {
+		containsStored |= file->isStored;
+
+		const uint64_t copyBegin = std::max(chunkBegin, file->offset);
+		const uint64_t copyEnd = std::min(chunkEnd, file->offset + file->data->size());
+
+		std::memcpy(
+			dest.data() + (copyBegin - chunkBegin),
+			file->data->data() + (copyBegin - file->offset),
+			copyEnd - copyBegin);
+	}
+
+	return containsStored;
+}
+
+std::vector<uint8_t> ArchiveWriter::m_trainDictionary(std::span<const FileLayout> files, size_t chunkCount) const {
+	const size_t maxSampleCount = std::max<size_t>(1, m_dictionary_size * m_dictionary_sample_ratio / m_chunk_size);
+	const size_t stride = std::max<size_t>(1, chunkCount / maxSampleCount);
+
+	std::vector<uint8_t> samples;
+	std::vector<size_t> sampleSizes;
+	std::vector<uint8_t> chunk(m_chunk_size);
+	for (size_t i = 0; i < chunkCount && sampleSizes.size() < maxSampleCount; i += stride) {
+		if (m_fillChunk(i, files, chunk)) {
+			continue;
+		}
+
+		samples.insert(samples.end(), chunk.begin(), chunk.end());
+		sampleSizes.emplace_back(m_chunk_size);
+	}
+
+	return Helpers::Compress::TrainZStdDictionary(samples, sampleSizes, m_dictionary_size);
+}
+
+std::vector<ArchiveWriter::CompressedBlock> ArchiveWriter::m_compressChunks(std::span<const FileLayout> files, size_t chunkCount, const ZSTD_CDict* dictionary) const {
+	const size_t blockCount = (chunkCount + m_chunks_per_task - 1) / m_chunks_per_task;
+
+	// ブロックの結果は順番通りに返るので、スレッド数に関係なく同じ並びになる
+	return m_thread_pool->submit_blocks(size_t{ 0 }, chunkCount,
+		[this, files, dictionary](const size_t blockBegin, const size_t blockEnd) {
+			CompressedBlock block;
+			block.sizes.reserve(blockEnd - blockBegin);
+
+			auto* context = Helpers::Compress::GetThreadLocalZStdCompressionContext();
+			std::vector<uint8_t> chunk(m_chunk_size);
+			for (size_t i = blockBegin; i < blockEnd; ++i) {
+				if (m_fillChunk(i, files, chunk)) {
+					block.data.insert(block.data.end(), chunk.begin(), chunk.end());
+					block.sizes.emplace_back(m_chunk_size);
+					continue;
+				}
+
+				const size_t oldSize = block.data.size();
+				size_t size = dictionary
+					? Helpers::Compress::ZStdCompress(context, dictionary, chunk, block.data)
+					: Helpers::Compress::ZStdCompress(context, chunk, block.data, m_compression_level);
+
+				// 1.3以降、圧縮しても小さくならないチャンクはそのまま格納する
+				if (m_hasRawChunks() && size >= m_chunk_size) {
+					block.data.resize(oldSize);
+					block.data.insert(block.data.end(), chunk.begin(), chunk.end());
+					size = m_chunk_size;
+				}
+				block.sizes.emplace_back(size);
+			}
+
+			return block;
+		},
+		blockCount
+	).get();
+}
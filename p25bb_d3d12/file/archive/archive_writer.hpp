@@ -0,0 +1,137 @@
+#pragma once
+#include <filesystem>
+#include <memory>
+#include <vector>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <ostream>
+#include <BS_thread_pool.hpp/BS_thread_pool.hpp>
+
+#include "types.hpp"
+#include "../../helpers/compress.hpp"
+
+namespace PameECS::File::Archive {
+	// specs/peac.mdの形式でアーカイブを作る
+	// 同じ内容を追加すれば、追加した順番やスレッド数に関係なく同じバイト列になる
+	class ArchiveWriter {
+	public:
+		enum class Storage {
+			Compressed,
+			// 圧縮せずに格納する(1.3以降)、ローダーのGetStoredFileDataでコピーせずに参照できる
+			// OggやKTX2など、既に圧縮されているデータ向け
+			Stored,
+		};
+
+		struct Properties {
+			// ZStandardの圧縮レベル、nulloptであれば3
+			std::optional<int> compressionLevel;
+			// 書き込むフォーマットのマイナーバージョン(0~4)、nulloptであれば4
+			std::optional<uint8_t> versionMinor;
+			// データチャンクのサイズ、nulloptであれば2048
+			// 2048以外は1.2以降でのみ指定でき、512B~16MiBの2の累乗であること
+			// 大きいほど圧縮率が上がりチャンクインデックスが小さくなるが、小さいファイルの読み込みで余分に展開する量が増える
+			std::optional<size_t> chunkSize;
+			// ファイルが必要以上のチャンクにまたがらないように、データの位置をチャンクの境界に揃えるか、nulloptであれば揃える
+			// 次のチャンクの先頭に送ると、ファイルがまたがるチャンクの数が減る場合だけ揃える(チャンクサイズ以下のファイルは1つのチャンクに収まる)
+			std::optional<bool> alignFilesToChunks;
+			// AddDirectoryTreeで、Storage::Storedで追加するファイルの拡張子(".ogg"など、大文字と小文字は区別する)、nulloptであれば無し
+			std::optional<std::vector<std::string>> storedExtensions;
+			// データチャンクから学習する辞書の最大サイズ(1.4以降)、nulloptか0であれば辞書を使わない
+			// 小さいチャンクほど効果が大きい、学習できるほどのデータがなければ辞書なしで書き込む
+			std::optional<size_t> dictionarySize;
+			// 1.1以降でパスのハッシュインデックスを書き込むか、nulloptであれば書き込む
+			std::optional<bool> writeHashIndex;
+			// 1つのタスクで圧縮するチャンク数、nulloptであれば64
+			std::optional<size_t> chunksPerTask;
+		};
+
+		ArchiveWriter(std::shared_ptr<BS::thread_pool<0U>> threadPool, const Properties& properties = {});
+		~ArchiveWriter() = default;
+		ArchiveWriter(const ArchiveWriter&) = delete;
+		ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+		ArchiveWriter(ArchiveWriter&&) = default;
+		ArchiveWriter& operator=(ArchiveWriter&&) = default;
+
+		// virtualPathは'/'か'\'区切り、途中のディレクトリは自動で作られる
+		// フォーマット上サイズ0のファイルはディレクトリと区別できないので、空のデータは追加できない
+		void AddFile(std::string_view virtualPath, std::vector<uint8_t> data, Storage storage = Storage::Compressed);
+		void AddFile(std::string_view virtualPath, const std::filesystem::path& sourcePath, Storage storage = Storage::Compressed);
+		void AddDirectory(std::string_view virtualPath);
+		// sourceDirectory以下のファイルを、virtualPath以下に再帰的に追加する
+		void AddDirectoryTree(const std::filesystem::path& sourceDirectory, std::string_view virtualPath = "");
+
+		void Write(const std::filesystem::path& path) const;
+		void Write(std::ostream& stream) const;
+	private:
+		struct Node {
+			std::map<std::string, Node, std::less<>> children;
+			std::vector<uint8_t> data;
+			bool isFile = false;
+			bool isStored = false;
+		};
+
+		// 書き込み時に使う、データ部分でのファイルの位置
+		struct FileLayout {
+			uint64_t offset;
+			const std::vector<uint8_t>* data;
+			bool isStored;
+		};
+
+		// 圧縮したチャンクをまとめたもの、sizesはチャンク毎の圧縮後のサイズ
+		struct CompressedBlock {
+			std::vector<uint8_t> data;
+			std::vector<uint64_t> sizes;
+		};
+
+		inline static constexpr int m_default_compression_level = 3;
+		// 書き込める最新のマイナーバージョン
+		inline static constexpr uint8_t m_latest_version_minor = 4;
+		// Properties::versionMinorを指定しなかった場合のマイナーバージョン、m_latest_version_minor以下であること
+		inline static constexpr uint8_t m_default_version_minor = 4;
+		static_assert(m_default_version_minor <= m_latest_version_minor);
+		inline static constexpr size_t m_default_chunks_per_task = 64;
+		// zstdの推奨に従い、サンプルは辞書サイズの100倍程度にする
+		inline static constexpr size_t m_dictionary_sample_ratio = 100;
+
+		Node& m_getOrCreateNode(std::string_view virtualPath, bool isFile);
+
+		bool m_hasWideEntryCounts() const noexcept {
+			return m_version_minor >= 1;
+		}
+		bool m_hasChunkSizeExponent() const noexcept {
+			return m_version_minor >= 2;
+		}
+		bool m_hasRawChunks() const noexcept {
+			return m_version_minor >= 3;
+		}
+		bool m_hasDictionaryInformation() const noexcept {
+			return m_version_minor >= 4;
+		}
+
+		// エントリを行きがけ順に書き込み、同じ順番でファイルをデータ部分に並べる
+		void m_writeEntries(const Node& node, const std::string& parentPath, std::vector<uint8_t>& dest, std::vector<uint64_t>& pathHashes, std::vector<FileLayout>& files, uint64_t& dataSize) const;
+		void m_writeEntryCount(size_t count, std::vector<uint8_t>& dest) const;
+		// 全てのファイルを連結したバッファの、chunkIndex番目のチャンクを作る
+		// 圧縮せずに格納するファイルを含んでいればtrueを返す
+		bool m_fillChunk(size_t chunkIndex, std::span<const FileLayout> files, std::span<uint8_t> dest) const;
+		// 無圧縮で格納するものを除いたチャンクを、等間隔に選んでサンプルにする
+		std::vector<uint8_t> m_trainDictionary(std::span<const FileLayout> files, size_t chunkCount) const;
+		// dictionaryがnullptrであれば辞書なしで圧縮する
+		std::vector<CompressedBlock> m_compressChunks(std::span<const FileLayout> files, size_t chunkCount, const ZSTD_CDict* dictionary) const;
+
+		std::shared_ptr<BS::thread_pool<0U>> m_thread_pool;
+		Node m_root;
+
+		int m_compression_level = m_default_compression_level;
+		uint8_t m_version_minor = m_default_version_minor;
+		size_t m_chunk_size = Types::defaultChunkSize;
+		bool m_write_hash_index = true;
+		bool m_align_files_to_chunks = true;
+		std::vector<std::string> m_stored_extensions;
+		size_t m_dictionary_size = 0;
+		size_t m_chunks_per_task = m_default_chunks_per_task;
+	};
+}
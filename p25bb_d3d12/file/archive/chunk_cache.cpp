@@ -0,0 +1,84 @@
+#include "chunk_cache.hpp"
+#include <algorithm>
+
+using PameECS::File::Archive::ChunkCache;
+
+ChunkCache::ChunkCache(size_t byteBudget, size_t shardCount)
+	: m_byte_budget(byteBudget) {
+	shardCount = std::max<size_t>(1, shardCount);
+	m_shard_byte_budget = m_byte_budget / shardCount;
+
+	m_shards.reserve(shardCount);
+	for (size_t i = 0; i < shardCount; ++i) {
+		m_shards.emplace_back(std::make_unique<Shard>());
+	}
+}
+
+ChunkCache::ChunkData ChunkCache::Find(size_t chunkIndex) {
+	auto& shard = m_getShard(chunkIndex);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	auto it = shard.indexes.find(chunkIndex);
+	if (it == shard.indexes.end()) {
+		m_misses.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+	m_hits.fetch_add(1, std::memory_order_relaxed);
+	return it->second->second;
+}
+
+void ChunkCache::Insert(size_t chunkIndex, ChunkData data) {
+	if (!data || data->size() > m_shard_byte_budget) {
+		return;
+	}
+
+	auto& shard = m_getShard(chunkIndex);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	auto it = shard.indexes.find(chunkIndex);
+	if (it != shard.indexes.end()) {
+		// 他のスレッドが先に挿入していた場合は、既存のものを残す
+		shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+		return;
+	}
+
+	m_evict(shard, data->size());
+
+	shard.usedBytes += data->size();
+	shard.lru.emplace_front(chunkIndex, std::move(data));
+	shard.indexes.emplace(chunkIndex, shard.lru.begin());
+}
+
+void ChunkCache::Clear() {
+	for (auto& shard : m_shards) {
+		std::lock_guard<std::mutex> lock(shard->mutex);
+		shard->lru.clear();
+		shard->indexes.clear();
+		shard->usedBytes = 0;
+	}
+}
+
+ChunkCache::Statistics ChunkCache::GetStatistics() const {
+	Statistics statistics;
+	statistics.hits = m_hits.load(std::memory_order_relaxed);
+	statistics.misses = m_misses.load(std::memory_order_relaxed);
+	statistics.byteBudget = m_byte_budget;
+
+	for (const auto& shard : m_shards) {
+		std::lock_guard<std::mutex> lock(shard->mutex);
+		statistics.usedBytes += shard->usedBytes;
+	}
+
+	return statistics;
+}
+
+void ChunkCache::m_evict(Shard& shard, size_t requiredBytes) {
+	while (!shard.lru.empty() && shard.usedBytes + requiredBytes > m_shard_byte_budget) {
+		auto& [chunkIndex, data] = shard.lru.back();
+		shard.usedBytes -= data->size();
+		shard.indexes.erase(chunkIndex);
+		shard.lru.pop_back();
+	}
+}
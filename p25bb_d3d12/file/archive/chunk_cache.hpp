@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+namespace PameECS::File::Archive {
+	// 展開済みチャンクのLRUキャッシュ
+	// ロックの競合を減らすため、チャンクのインデックスでシャードを分けている
+	class ChunkCache {
+	public:
+		using ChunkData = std::shared_ptr<const std::vector<uint8_t>>;
+
+		struct Statistics {
+			uint64_t hits = 0;
+			uint64_t misses = 0;
+			size_t usedBytes = 0;
+			size_t byteBudget = 0;
+		};
+
+		inline static constexpr size_t defaultShardCount = 16;
+
+		// byteBudgetはシャード数で等分される、シャードの予算はキャッシュするチャンクより大きくすること
+		explicit ChunkCache(size_t byteBudget, size_t shardCount = defaultShardCount);
+		~ChunkCache() = default;
+		ChunkCache(const ChunkCache&) = delete;
+		ChunkCache& operator=(const ChunkCache&) = delete;
+
+		// 見つからなければnullptr
+		ChunkData Find(size_t chunkIndex);
+		// シャードの予算を超えるデータは挿入しない
+		void Insert(size_t chunkIndex, ChunkData data);
+		void Clear();
+
+		Statistics GetStatistics() const;
+	private:
+		struct Shard {
+			std::mutex mutex;
+			// 先頭が最近使用されたもの
+			std::list<std::pair<size_t, ChunkData>> lru;
+			std::unordered_map<size_t, std::list<std::pair<size_t, ChunkData>>::iterator> indexes;
+			size_t usedBytes = 0;
+		};
+
+		Shard& m_getShard(size_t chunkIndex) const {
+			return *m_shards[chunkIndex % m_shards.size()];
+		}
+
+		void m_evict(Shard& shard, size_t requiredBytes);
+
+		std::vector<std::unique_ptr<Shard>> m_shards;
+		size_t m_byte_budget;
+		size_t m_shard_byte_budget;
+
+		std::atomic<uint64_t> m_hits{ 0 };
+		std::atomic<uint64_t> m_misses{ 0 };
+	};
+}
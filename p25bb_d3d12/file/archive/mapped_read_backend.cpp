@@ -0,0 +1,20 @@
+#include "mapped_read_backend.hpp"
+#include <cstring>
+#include "../../exceptions/file_error.hpp"
+
+using PameECS::File::Archive::MappedReadBackend;
+
+MappedReadBackend::MappedReadBackend(const std::filesystem::path& path)
+	: m_file_map(path.c_str(), boost::interprocess::read_only),
+	m_file_view(m_file_map, boost::interprocess::read_only) {
+}
+
+void MappedReadBackend::Read(std::span<const ReadRequest> requests) const {
+	const auto data = GetMappedData();
+	for (const auto& request : requests) {
+		if (request.offset > data.size() || request.dest.size() > data.size() - request.offset) {
+			throw Exceptions::FileError("Attempted to read beyond the end of the mapped file.");
+		}
+		std::memcpy(request.dest.data(), data.data() + request.offset, request.dest.size());
+	}
+}
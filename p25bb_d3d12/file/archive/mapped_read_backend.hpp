@@ -0,0 +1,29 @@
+#pragma once
+#include <filesystem>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "read_backend_interface.hpp"
+
+namespace PameECS::File::Archive {
+	// ファイル全体を読み取り専用でメモリにマップする
+	// 読み込みはページフォールトで行われるので、常駐するメモリ量はOSに任せることになる
+	class MappedReadBackend : public IReadBackend {
+	public:
+		explicit MappedReadBackend(const std::filesystem::path& path);
+		~MappedReadBackend() override = default;
+		MappedReadBackend(const MappedReadBackend&) = delete;
+		MappedReadBackend& operator=(const MappedReadBackend&) = delete;
+
+		uint64_t GetSize() const override {
+			return m_file_view.get_size();
+		}
+		void Read(std::span<const ReadRequest> requests) const override;
+		std::span<const uint8_t> GetMappedData() const override {
+			return { static_cast<const uint8_t*>(m_file_view.get_address()), m_file_view.get_size() };
+		}
+	private:
+		boost::interprocess::file_mapping m_file_map;
+		boost::interprocess::mapped_region m_file_view;
+	};
+}
@@ -0,0 +1,144 @@
+#include "positional_read_backend.hpp"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "../../exceptions/file_error.hpp"
+
+#ifdef _WIN32
+#include "../../helpers/errors/windows.hpp"
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using PameECS::File::Archive::PositionalReadBackend;
+
+#ifdef _WIN32
+PositionalReadBackend::PositionalReadBackend(const std::filesystem::path& path) {
+	m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		throw Exceptions::FileError("Failed to open the archive file.\n" + Helpers::Errors::Windows::GetLastErrorMessage());
+	}
+
+	LARGE_INTEGER size = {};
+	if (!GetFileSizeEx(m_file, &size)) {
+		const std::string message = Helpers::Errors::Windows::GetLastErrorMessage();
+		CloseHandle(m_file);
+		throw Exceptions::FileError("Failed to get the archive file size.\n" + message);
+	}
+	m_size = static_cast<uint64_t>(size.QuadPart);
+}
+
+PositionalReadBackend::~PositionalReadBackend() {
+	CloseHandle(m_file);
+}
+
+void PositionalReadBackend::Read(std::span<const ReadRequest> requests) const {
+	struct PendingRead {
+		OVERLAPPED overlapped = {};
+		DWORD bytes = 0;
+		bool isIssued = false;
+	};
+
+	// 要求をReadFileの単位に分けておく
+	std::vector<std::pair<uint64_t, std::span<uint8_t>>> pieces;
+	for (const auto& request : requests) {
+		if (request.offset > m_size || request.dest.size() > m_size - request.offset) {
+			throw Exceptions::FileError("Attempted to read beyond the end of the archive file.");
+		}
+		for (uint64_t done = 0; done < request.dest.size(); done += m_max_read_bytes) {
+			const size_t bytes = static_cast<size_t>(std::min<uint64_t>(m_max_read_bytes, request.dest.size() - done));
+			pieces.emplace_back(request.offset + done, request.dest.subspan(done, bytes));
+		}
+	}
+
+	std::vector<PendingRead> pending(std::min(pieces.size(), m_max_reads_in_flight));
+	for (size_t batchBegin = 0; batchBegin < pieces.size(); batchBegin += pending.size()) {
+		const size_t batchSize = std::min(pending.size(), pieces.size() - batchBegin);
+		std::string error;
+
+		// まとめて発行してから完了を待つ、発行済みの読み込みは失敗しても必ず待つ
+		for (size_t i = 0; i < batchSize && error.empty(); ++i) {
+			const auto& [offset, dest] = pieces[batchBegin + i];
+			auto& read = pending[i];
+			read = {};
+			read.overlapped.Offset = static_cast<DWORD>(offset);
+			read.overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			read.overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+			if (!read.overlapped.hEvent) {
+				error = Helpers::Errors::Windows::GetLastErrorMessage();
+				break;
+			}
+
+			if (!ReadFile(m_file, dest.data(), static_cast<DWORD>(dest.size()), nullptr, &read.overlapped)
+				&& GetLastError() != ERROR_IO_PENDING) {
+				error = Helpers::Errors::Windows::GetLastErrorMessage();
+				CloseHandle(read.overlapped.hEvent);
+				break;
+			}
+			read.isIssued = true;
+		}
+
+		for (size_t i = 0; i < batchSize; ++i) {
+			auto& read = pending[i];
+			if (!read.isIssued) {
+				break;
+			}
+
+			if (!GetOverlappedResult(m_file, &read.overlapped, &read.bytes, TRUE) && error.empty()) {
+				error = Helpers::Errors::Windows::GetLastErrorMessage();
+			}
+			else if (read.bytes != pieces[batchBegin + i].second.size() && error.empty()) {
+				error = "Unexpected end of file.";
+			}
+			CloseHandle(read.overlapped.hEvent);
+		}
+
+		if (!error.empty()) {
+			throw Exceptions::FileError("Failed to read the archive file.\n" + error);
+		}
+	}
+}
+#else
+PositionalReadBackend::PositionalReadBackend(const std::filesystem::path& path) {
+	m_file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (m_file < 0) {
+		throw Exceptions::FileError("Failed to open the archive file.");
+	}
+
+	struct stat status = {};
+	if (fstat(m_file, &status) != 0) {
+		close(m_file);
+		throw Exceptions::FileError("Failed to get the archive file size.");
+	}
+	m_size = static_cast<uint64_t>(status.st_size);
+}
+
+PositionalReadBackend::~PositionalReadBackend() {
+	close(m_file);
+}
+
+void PositionalReadBackend::Read(std::span<const ReadRequest> requests) const {
+	for (const auto& request : requests) {
+		if (request.offset > m_size || request.dest.size() > m_size - request.offset) {
+			throw Exceptions::FileError("Attempted to read beyond the end of the archive file.");
+		}
+
+		// preadは要求より少なく読んで戻ることがあるので、読み切るまで繰り返す
+		size_t done = 0;
+		while (done < request.dest.size()) {
+			const size_t bytes = static_cast<size_t>(std::min<uint64_t>(m_max_read_bytes, request.dest.size() - done));
+			const ssize_t result = pread(m_file, request.dest.data() + done, bytes, static_cast<off_t>(request.offset + done));
+			if (result < 0 && errno == EINTR) {
+				continue;
+			}
+			if (result <= 0) {
+				throw Exceptions::FileError("Failed to read the archive file.");
+			}
+			done += static_cast<size_t>(result);
+		}
+	}
+}
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+#include <filesystem>
+
+#include "read_backend_interface.hpp"
+
+namespace PameECS::File::Archive {
+	// ファイルをマップせず、位置を指定した読み込み(WindowsではOVERLAPPEDのReadFile、それ以外ではpread)で必要な範囲だけ読む
+	// 読み込み先のバッファは呼び出し側が持つので、常駐するメモリ量を呼び出し側で制限できる
+	// Windowsでは1回のReadで受けた要求をまとめて発行してから完了を待つ
+	class PositionalReadBackend : public IReadBackend {
+	public:
+		explicit PositionalReadBackend(const std::filesystem::path& path);
+		~PositionalReadBackend() override;
+		PositionalReadBackend(const PositionalReadBackend&) = delete;
+		PositionalReadBackend& operator=(const PositionalReadBackend&) = delete;
+
+		uint64_t GetSize() const override {
+			return m_size;
+		}
+		void Read(std::span<const ReadRequest> requests) const override;
+	private:
+#ifdef _WIN32
+		using NativeHandle = void*; // HANDLE
+#else
+		using NativeHandle = int;
+#endif
+
+		// ReadFileのサイズはDWORDなので、大きい要求はこの単位に分ける
+		inline static constexpr uint64_t m_max_read_bytes = 1ULL << 30;
+		// 一度に発行する読み込みの数
+		inline static constexpr size_t m_max_reads_in_flight = 64;
+
+		NativeHandle m_file;
+		uint64_t m_size = 0;
+	};
+}
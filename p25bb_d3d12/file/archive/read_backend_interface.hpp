@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <span>
+
+namespace PameECS::File::Archive {
+	// ArchiveLoaderがアーカイブのバイト列を読むための入出力の実装
+	// 全てのメンバ関数は、複数のスレッドから同時に呼ばれても安全であること
+	class IReadBackend {
+	public:
+		struct ReadRequest {
+			uint64_t offset;
+			std::span<uint8_t> dest;
+		};
+
+		virtual ~IReadBackend() = default;
+		virtual uint64_t GetSize() const = 0;
+		// 全ての要求を読み終えるまで戻らない、まとめて発行できる実装はまとめて発行する
+		// 範囲外の要求や読み込みの失敗ではFileErrorを投げる
+		virtual void Read(std::span<const ReadRequest> requests) const = 0;
+		// ファイル全体がメモリにマップされていればその領域、そうでなければ空
+		// 空でなければ、バックエンドが破棄されるまで有効
+		virtual std::span<const uint8_t> GetMappedData() const { return {}; }
+	};
+}
@@ -11,6 +11,12 @@
 #include "../../template_types/string_literal.hpp"
 
 namespace PameECS::File::Archive::Types {
+	// データチャンク1つの展開後のサイズ、1.2より前は常にこの値
+	inline constexpr size_t defaultChunkSize = 2048;
+	// 1.2以降で指定できるデータチャンクのサイズの範囲(2の指数)、512B~16MiB
+	inline constexpr uint8_t minChunkSizeExponent = 9;
+	inline constexpr uint8_t maxChunkSizeExponent = 24;
+
 	template<typename Derived, std::endian ExpectedEndian = std::endian::little>
 	struct AutoProcessing {
 		void ToNativeEndian() {
@@ -78,7 +84,7 @@ namespace PameECS::File::Archive::Types {
 		uint8_t versionMajor;
 		uint8_t versionMinor;
 		uint8_t versionPatch;
-		uint8_t reserved;
+		uint8_t chunkSizeExponent; // 1.2以降はデータチャンクのサイズの2の指数、それより前は予約済み
 
 		[[nodiscard]] bool IsValid() const {
 			bool isMagicValid = std::memcmp(magic, "PEAC", 4) == 0;
@@ -92,7 +98,7 @@ namespace PameECS::File::Archive::Types {
 			func.operator()<"versionMajor">(versionMajor);
 			func.operator()<"versionMinor">(versionMinor);
 			func.operator()<"versionPatch">(versionPatch);
-			func.operator()<"reserved">(reserved);
+			func.operator()<"chunkSizeExponent">(chunkSizeExponent);
 		}
 	};
 
@@ -113,28 +119,40 @@ namespace PameECS::File::Archive::Types {
 		}
 	};
 
-	struct Entry : AutoProcessing<Entry> {
-		uint64_t dataSize;
-		uint64_t dataOffset;
-		uint16_t nameLength;
-		std::string name;
-		std::vector<Entry> children;
+	// 1.4以降、サイズ情報の直後に置かれる
+	struct alignas(4) DictionaryInformation : AutoProcessing<DictionaryInformation> {
+		uint32_t dictionarySize; // 0であれば辞書なし
+		uint32_t reserved;
 
 		template<typename Func>
 		void ForEachMember(Func&& func) {
-			func.operator()<"dataSize">(dataSize);
-			func.operator()<"dataOffset">(dataOffset);
-			func.operator()<"nameLength">(nameLength);
-			func.operator()<"name">(name);
+			func.operator()<"dictionarySize">(dictionarySize);
+			func.operator()<"reserved">(reserved);
 		}
 	};
 
+	// エントリ情報を平坦な配列に展開したもの
+	// 兄弟のエントリは連続して並ぶので、子エントリは[firstChild, firstChild + childCount)
+	struct Entry {
+		uint64_t dataSize = 0;
+		uint64_t dataOffset = 0;
+		uint64_t pathOffset = 0; // ローダーが持つパスのブロブ内の開始位置
+		uint32_t pathLength = 0;
+		uint32_t firstChild = 0;
+		uint32_t childCount = 0;
+		uint32_t descendantCount = 0; // 子孫はfirstChildから連続して並ぶ
+		uint16_t nameLength = 0; // 名前はパスの末尾nameLengthバイト
+		bool isStored = false; // データが全て無圧縮のチャンクにあり、ファイル内で連続している
+	};
+
 	inline constexpr bool TypeAssertion() {
 		static_assert(sizeof(Header) == 8, "Size of Header must be 8 bytes.");
 		static_assert(sizeof(SizeInformation) == 32, "Size of SizeInformation must be 32 bytes.");
+		static_assert(sizeof(DictionaryInformation) == 8, "Size of DictionaryInformation must be 8 bytes.");
 
 		static_assert(std::is_trivially_copyable_v<Header>, "Header must be trivially copyable.");
 		static_assert(std::is_trivially_copyable_v<SizeInformation>, "SizeInformation must be trivially copyable.");
+		static_assert(std::is_trivially_copyable_v<DictionaryInformation>, "DictionaryInformation must be trivially copyable.");
 
 		return true; // 戻り値に意味はない
 	}
@@ -0,0 +1,303 @@
+#include "virtual_file_system.hpp"
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <mutex>
+#include "../helpers/path.hpp"
+#include "../exceptions/file_error.hpp"
+#include "../exceptions/invalid_argument.hpp"
+
+using PameECS::File::VirtualFileSystem;
+
+namespace {
+	std::vector<uint8_t> ReadWholeFile(const std::filesystem::path& path, size_t size) {
+		std::ifstream stream(path, std::ios::binary);
+		if (!stream) {
+			throw PameECS::Exceptions::FileError("Failed to open the source file.");
+		}
+
+		std::vector<uint8_t> data(size);
+		stream.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+		if (!stream) {
+			throw PameECS::Exceptions::FileError("Failed to read the source file.");
+		}
+
+		return data;
+	}
+}
+
+VirtualFileSystem::VirtualFileSystem(std::shared_ptr<BS::thread_pool<0U>> threadPool)
+	: m_thread_pool(threadPool) {
+	assert(m_thread_pool);
+
+	m_rebuildIndex();
+}
+
+VirtualFileSystem::MountId VirtualFileSystem::MountArchive(std::shared_ptr<Archive::ArchiveLoader> archive, std::string_view mountPoint, int priority) {
+	if (!archive) {
+		throw Exceptions::InvalidArgument("The archive is null.");
+	}
+
+	return m_addMount({ 0, priority, Helpers::Path::NormalizeVirtualPath(mountPoint), std::move(archive), {} });
+}
+
+VirtualFileSystem::MountId VirtualFileSystem::MountDirectory(const std::filesystem::path& directory, std::string_view mountPoint, int priority) {
+	if (!std::filesystem::is_directory(directory)) {
+		throw Exceptions::FileError("The directory to mount does not exist.");
+	}
+
+	return m_addMount({ 0, priority, Helpers::Path::NormalizeVirtualPath(mountPoint), nullptr, directory });
+}
+
+void VirtualFileSystem::Unmount(MountId id) {
+	std::unique_lock lock(m_mutex);
+
+	auto it = std::find_if(m_mounts.begin(), m_mounts.end(), [id](const Mount& mount) {
+		return mount.id == id;
+	});
+	if (it == m_mounts.end()) {
+		throw Exceptions::InvalidArgument("No mount found for the given id.");
+	}
+
+	m_mounts.erase(it);
+	m_rebuildIndex();
+}
+
+bool VirtualFileSystem::IsExist(std::string_view virtualPath) const {
+	std::shared_lock lock(m_mutex);
+	return m_findNode(virtualPath) != nullptr;
+}
+
+bool VirtualFileSystem::IsFile(std::string_view virtualPath) const {
+	std::shared_lock lock(m_mutex);
+	const Node* node = m_findNode(virtualPath);
+	return node && !node->isDirectory;
+}
+
+bool VirtualFileSystem::IsDirectory(std::string_view virtualPath) const {
+	std::shared_lock lock(m_mutex);
+	const Node* node = m_findNode(virtualPath);
+	return node && node->isDirectory;
+}
+
+uint64_t VirtualFileSystem::GetFileSize(std::string_view virtualPath) const {
+	std::shared_lock lock(m_mutex);
+	return m_getFileNode(virtualPath).size;
+}
+
+std::vector<std::string> VirtualFileSystem::GetChildNames(std::string_view virtualPath) const {
+	std::shared_lock lock(m_mutex);
+	const Node& node = m_getNode(virtualPath);
+	return { node.childNames.begin(), node.childNames.end() };
+}
+
+std::future<std::vector<uint8_t>> VirtualFileSystem::GetFileDataAsync(std::string_view virtualPath) const {
+	std::shared_lock lock(m_mutex);
+	const Node& node = m_getFileNode(virtualPath);
+
+	if (node.entry) {
+		return m_mounts[node.mountIndex].archive->GetFileDataAsync(*node.entry);
+	}
+
+	return m_thread_pool->submit_task([sourcePath = node.sourcePath, size = node.size]() {
+		return ReadWholeFile(sourcePath, size);
+	});
+}
+
+std::future<void> VirtualFileSystem::GetFileDataAsync(std::string_view virtualPath, std::span<uint8_t> dest) const {
+	std::shared_lock lock(m_mutex);
+	const Node& node = m_getFileNode(virtualPath);
+
+	if (node.entry) {
+		return m_mounts[node.mountIndex].archive->GetFileDataAsync(*node.entry, dest);
+	}
+
+	if (dest.size() < node.size) {
+		throw Exceptions::InvalidArgument("The destination buffer is smaller than the file.");
+	}
+
+	return m_thread_pool->submit_task([sourcePath = node.sourcePath, dest = dest.first(node.size)]() {
+		std::ifstream stream(sourcePath, std::ios::binary);
+		stream.read(reinterpret_cast<char*>(dest.data()), static_cast<std::streamsize>(dest.size()));
+		if (!stream) {
+			throw Exceptions::FileError("Failed to read the source file.");
+		}
+	});
+}
+
+VirtualFileSystem::MountId VirtualFileSystem::m_addMount(Mount mount) {
+	std::unique_lock lock(m_mutex);
+
+	mount.id = m_next_mount_id++;
+	const MountId id = mount.id;
+	m_mounts.emplace_back(std::move(mount));
+
+	try {
+		m_rebuildIndex();
+	}
+	catch (...) {
+		// 索引が中途半端にならないように、追加したマウントを外して作り直す
+		std::erase_if(m_mounts, [id](const Mount& mounted) {
+			return mounted.id == id;
+		});
+		m_rebuildIndex();
+		throw;
+	}
+
+	return id;
+}
+
+void VirtualFileSystem::m_rebuildIndex() {
+	// 優先度の低い順に索引に入れ、同じパスは後から入れたもので上書きする
+	std::stable_sort(m_mounts.begin(), m_mounts.end(), [](const Mount& a, const Mount& b) {
+		return a.priority != b.priority ? a.priority < b.priority : a.id < b.id;
+	});
+
+	m_index.clear();
+	m_index.emplace(std::string(), Node{});
+
+	for (size_t mountIndex = 0; mountIndex < m_mounts.size(); ++mountIndex) {
+		const Mount& mount = m_mounts[mountIndex];
+		if (!mount.mountPoint.empty()) {
+			m_insert(mount.mountPoint, mountIndex, true);
+		}
+
+		if (mount.archive) {
+			for (const auto& entry : mount.archive->GetRootEntries()) {
+				m_indexArchive(mountIndex, *mount.archive, entry);
+			}
+		}
+		else {
+			m_indexDirectory(mountIndex, mount);
+		}
+	}
+
+	// 子の名前はキーの末尾を指す、unordered_mapの要素は再ハッシュでも移動しない
+	for (const auto& [path, node] : m_index) {
+		if (path.empty()) {
+			continue;
+		}
+
+		const size_t separator = path.rfind('/');
+		const std::string_view parent = separator == std::string::npos ? std::string_view() : std::string_view(path).substr(0, separator);
+		const std::string_view name = separator == std::string::npos ? std::string_view(path) : std::string_view(path).substr(separator + 1);
+		m_index.find(parent)->second.childNames.emplace_back(name);
+	}
+
+	for (auto& [path, node] : m_index) {
+		std::sort(node.childNames.begin(), node.childNames.end());
+	}
+}
+
+void VirtualFileSystem::m_indexArchive(size_t mountIndex, const Archive::ArchiveLoader& archive, const Archive::Types::Entry& entry) {
+	const std::string path = m_joinPath(m_mounts[mountIndex].mountPoint, archive.GetPath(entry));
+
+	if (archive.IsDirectory(entry)) {
+		m_insert(path, mountIndex, true);
+		for (const auto& child : archive.GetChildren(entry)) {
+			m_indexArchive(mountIndex, archive, child);
+		}
+		return;
+	}
+
+	Node& node = m_insert(path, mountIndex, false);
+	node.size = entry.dataSize;
+	node.entry = &entry;
+}
+
+void VirtualFileSystem::m_indexDirectory(size_t mountIndex, const Mount& mount) {
+	for (const auto& entry : std::filesystem::recursive_directory_iterator(mount.directory)) {
+		// 仮想パスはUTF-8にする
+		const auto relative = entry.path().lexically_relative(mount.directory).generic_u8string();
+		const std::string path = m_joinPath(mount.mountPoint, std::string(relative.begin(), relative.end()));
+
+		if (entry.is_directory()) {
+			m_insert(path, mountIndex, true);
+		}
+		else if (entry.is_regular_file()) {
+			Node& node = m_insert(path, mountIndex, false);
+			node.size = entry.file_size();
+			node.sourcePath = entry.path();
+		}
+	}
+}
+
+VirtualFileSystem::Node& VirtualFileSystem::m_insert(const std::string& path, size_t mountIndex, bool isDirectory) {
+	// 途中のディレクトリを作る、優先度の低いマウントのファイルがあればディレクトリで上書きする
+	for (size_t separator = path.find('/'); separator != std::string::npos; separator = path.find('/', separator + 1)) {
+		const std::string_view parent = std::string_view(path).substr(0, separator);
+		auto it = m_index.find(parent);
+		if (it == m_index.end()) {
+			m_index.emplace(std::string(parent), Node{ mountIndex });
+		}
+		else if (!it->second.isDirectory) {
+			it->second = Node{ mountIndex };
+		}
+	}
+
+	auto [it, isInserted] = m_index.try_emplace(path);
+	Node& node = it->second;
+	if (!isInserted && node.isDirectory && isDirectory) {
+		return node;
+	}
+
+	// 優先度の高いマウントのファイルで隠れたディレクトリの中身は、見えないようにする
+	if (!isInserted && node.isDirectory && !isDirectory) {
+		m_eraseDescendants(path);
+	}
+
+	node = Node{ mountIndex };
+	node.isDirectory = isDirectory;
+	return node;
+}
+
+void VirtualFileSystem::m_eraseDescendants(const std::string& path) {
+	const std::string prefix = path + '/';
+	std::erase_if(m_index, [&prefix](const auto& item) {
+		return item.first.starts_with(prefix);
+	});
+}
+
+const VirtualFileSystem::Node& VirtualFileSystem::m_getNode(std::string_view virtualPath) const {
+	const Node* node = m_findNode(virtualPath);
+	if (!node) {
+		throw Exceptions::FileError("No entry found for the given path.");
+	}
+
+	return *node;
+}
+
+const VirtualFileSystem::Node* VirtualFileSystem::m_findNode(std::string_view virtualPath) const {
+	auto it = m_index.find(virtualPath);
+	if (it == m_index.end()) {
+		// '\'区切りや連続した区切りが含まれている場合だけ、正規化してから探し直す
+		if (Helpers::Path::IsNormalizedVirtualPath(virtualPath)) {
+			return nullptr;
+		}
+		it = m_index.find(Helpers::Path::NormalizeVirtualPath(virtualPath));
+	}
+
+	return it != m_index.end() ? &it->second : nullptr;
+}
+
+const VirtualFileSystem::Node& VirtualFileSystem::m_getFileNode(std::string_view virtualPath) const {
+	const Node& node = m_getNode(virtualPath);
+	if (node.isDirectory) {
+		throw Exceptions::InvalidArgument("The entry is not a file.");
+	}
+
+	return node;
+}
+
+std::string VirtualFileSystem::m_joinPath(std::string_view parent, std::string_view child) {
+	if (parent.empty()) {
+		return std::string(child);
+	}
+
+	std::string result;
+	result.reserve(parent.size() + 1 + child.size());
+	result.append(parent);
+	result += '/';
+	result.append(child);
+	return result;
+}
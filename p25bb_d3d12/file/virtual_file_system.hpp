@@ -0,0 +1,103 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <BS_thread_pool.hpp/BS_thread_pool.hpp>
+
+#include "archive/archive_loader.hpp"
+#include "../helpers/hash.hpp"
+
+namespace PameECS::File {
+	// 複数のアーカイブやディレクトリを仮想パスにマウントし、1つのファイルシステムとして扱う
+	// 同じパスに複数のファイルがあれば、優先度の高いマウントのものが見える(ベース、DLC、パッチの重ね合わせ)
+	// パスの解決はマウント時に作る1つのハッシュ表で行い、マウント毎に探し直すことはない
+	class VirtualFileSystem {
+	public:
+		using MountId = uint32_t;
+
+		explicit VirtualFileSystem(std::shared_ptr<BS::thread_pool<0U>> threadPool);
+		~VirtualFileSystem() = default;
+		VirtualFileSystem(const VirtualFileSystem&) = delete;
+		VirtualFileSystem& operator=(const VirtualFileSystem&) = delete;
+
+		// mountPointは'/'か'\'区切り、空であれば仮想ルート
+		// priorityが大きいほど優先され、同じであれば後からマウントしたものが優先される
+		MountId MountArchive(std::shared_ptr<Archive::ArchiveLoader> archive, std::string_view mountPoint, int priority = 0);
+		// ディレクトリの中身はマウント時点のものを使う、後から追加されたファイルは見えない
+		MountId MountDirectory(const std::filesystem::path& directory, std::string_view mountPoint, int priority = 0);
+		// 読み込み中のファイルがあるマウントを外してはいけない
+		void Unmount(MountId id);
+
+		bool IsExist(std::string_view virtualPath) const;
+		bool IsFile(std::string_view virtualPath) const;
+		bool IsDirectory(std::string_view virtualPath) const;
+		uint64_t GetFileSize(std::string_view virtualPath) const;
+		// 全てのマウントの子エントリをまとめた名前の一覧、名前順に並ぶ
+		std::vector<std::string> GetChildNames(std::string_view virtualPath) const;
+
+		std::vector<uint8_t> GetFileData(std::string_view virtualPath) const {
+			return GetFileDataAsync(virtualPath).get();
+		}
+		std::future<std::vector<uint8_t>> GetFileDataAsync(std::string_view virtualPath) const;
+
+		// destはGetFileSizeバイト以上で、futureが完了するまで有効であること
+		void GetFileData(std::string_view virtualPath, std::span<uint8_t> dest) const {
+			GetFileDataAsync(virtualPath, dest).get();
+		}
+		std::future<void> GetFileDataAsync(std::string_view virtualPath, std::span<uint8_t> dest) const;
+	private:
+		struct Mount {
+			MountId id;
+			int priority;
+			std::string mountPoint;
+			std::shared_ptr<Archive::ArchiveLoader> archive; // ディレクトリのマウントであればnullptr
+			std::filesystem::path directory;
+		};
+
+		struct Node {
+			size_t mountIndex = 0;
+			bool isDirectory = true;
+			uint64_t size = 0;
+			const Archive::Types::Entry* entry = nullptr; // アーカイブのファイル
+			std::filesystem::path sourcePath; // ディレクトリのマウントのファイル
+			std::vector<std::string_view> childNames; // キーの文字列を指す
+		};
+
+		struct PathHash {
+			using is_transparent = void;
+			size_t operator()(std::string_view path) const noexcept {
+				return static_cast<size_t>(Helpers::Hash::Fnv1a64(path));
+			}
+		};
+
+		MountId m_addMount(Mount mount);
+		// マウントを優先度の低い順に並べ、全てのマウントのエントリから索引を作り直す
+		void m_rebuildIndex();
+		void m_indexArchive(size_t mountIndex, const Archive::ArchiveLoader& archive, const Archive::Types::Entry& entry);
+		void m_indexDirectory(size_t mountIndex, const Mount& mount);
+		// 途中のディレクトリも作る、既にあれば上書きする
+		Node& m_insert(const std::string& path, size_t mountIndex, bool isDirectory);
+		void m_eraseDescendants(const std::string& path);
+
+		const Node& m_getNode(std::string_view virtualPath) const;
+		const Node* m_findNode(std::string_view virtualPath) const;
+		const Node& m_getFileNode(std::string_view virtualPath) const;
+
+		static std::string m_joinPath(std::string_view parent, std::string_view child);
+
+		std::shared_ptr<BS::thread_pool<0U>> m_thread_pool;
+
+		// 索引の再構築と参照を排他する
+		mutable std::shared_mutex m_mutex;
+		std::vector<Mount> m_mounts;
+		std::unordered_map<std::string, Node, PathHash, std::equal_to<>> m_index;
+		MountId m_next_mount_id = 0;
+	};
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <bit>
+#include <cstddef>
 
 namespace PameECS::Helpers::Binary {
 	template<typename T, std::endian Source, std::endian Native = std::endian::native>
@@ -10,4 +11,15 @@ namespace PameECS::Helpers::Binary {
 			return std::byteswap(value);
 		}
 	}
+
+	// バイトの入れ替えは元に戻す操作と同じなので、ToNativeEndianと同じ変換になる
+	template<typename T, std::endian Target, std::endian Native = std::endian::native>
+	T FromNativeEndian(T value) {
+		return ToNativeEndian<T, Target, Native>(value);
+	}
+
+	// valueをalignmentの倍数に切り上げる、alignmentは0でないこと
+	constexpr size_t AlignUp(size_t value, size_t alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
 }
@@ -1,29 +1,171 @@
+#pragma once
 #include <zstd/zstd.h>
+#include <zstd/zdict.h>
 #include <vector>
+#include <span>
+#include <memory>
 
 #include "../exceptions/compress_error.hpp"
 
 namespace PameECS::Helpers::Compress {
-	inline std::vector<uint8_t> ZStdCompress(const std::vector<uint8_t>& data, int compressionLevel = 3) {
-		size_t compressedSize = ZSTD_compressBound(data.size());
-		if (ZSTD_isError(compressedSize)) {
+	struct ZStdCompressionContextDeleter {
+		void operator()(ZSTD_CCtx* context) const noexcept {
+			ZSTD_freeCCtx(context);
+		}
+	};
+
+	using ZStdCompressionContext = std::unique_ptr<ZSTD_CCtx, ZStdCompressionContextDeleter>;
+
+	inline ZStdCompressionContext CreateZStdCompressionContext() {
+		ZStdCompressionContext context(ZSTD_createCCtx());
+		if (!context) {
+			throw Exceptions::CompressError("ZStd compression context creation failed.");
+		}
+		return context;
+	}
+
+	// 小さいデータを大量に圧縮する場合に、コンテキストを作り直さないようにスレッド毎に使い回す
+	inline ZSTD_CCtx* GetThreadLocalZStdCompressionContext() {
+		thread_local ZStdCompressionContext context = CreateZStdCompressionContext();
+		return context.get();
+	}
+
+	// destの末尾に圧縮したデータを追加し、追加したサイズを返す
+	inline size_t ZStdCompress(ZSTD_CCtx* context, std::span<const uint8_t> data, std::vector<uint8_t>& dest, int compressionLevel = 3) {
+		const size_t bound = ZSTD_compressBound(data.size());
+		if (ZSTD_isError(bound)) {
 			throw Exceptions::CompressError("ZStd compression bound calculation failed");
 		}
-		std::vector<uint8_t> compressedData(compressedSize);
-		compressedSize = ZSTD_compress(compressedData.data(), compressedData.size(), data.data(), data.size(), compressionLevel);
+
+		const size_t oldSize = dest.size();
+		dest.resize(oldSize + bound);
+		const size_t compressedSize = ZSTD_compressCCtx(context, dest.data() + oldSize, bound, data.data(), data.size(), compressionLevel);
 		if (ZSTD_isError(compressedSize)) {
+			dest.resize(oldSize);
 			throw Exceptions::CompressError("ZStd compression failed");
 		}
-		compressedData.resize(compressedSize);
+		dest.resize(oldSize + compressedSize);
+		return compressedSize;
+	}
+
+	inline std::vector<uint8_t> ZStdCompress(std::span<const uint8_t> data, int compressionLevel = 3) {
+		std::vector<uint8_t> compressedData;
+		ZStdCompress(GetThreadLocalZStdCompressionContext(), data, compressedData, compressionLevel);
 		return compressedData;
 	}
 
-	inline std::vector<uint8_t> ZStdDecompress(const std::vector<uint8_t>& data, size_t decompressedSize) {
-		std::vector<uint8_t> decompressedData(decompressedSize);
-		size_t result = ZSTD_decompress(decompressedData.data(), decompressedData.size(), data.data(), data.size());
+	struct ZStdCompressionDictionaryDeleter {
+		void operator()(ZSTD_CDict* dictionary) const noexcept {
+			ZSTD_freeCDict(dictionary);
+		}
+	};
+
+	// 辞書を解析済みの状態で持つ、読み取り専用なので複数のスレッドで共有できる
+	using ZStdCompressionDictionary = std::unique_ptr<ZSTD_CDict, ZStdCompressionDictionaryDeleter>;
+
+	inline ZStdCompressionDictionary CreateZStdCompressionDictionary(std::span<const uint8_t> dictionary, int compressionLevel = 3) {
+		ZStdCompressionDictionary result(ZSTD_createCDict(dictionary.data(), dictionary.size(), compressionLevel));
+		if (!result) {
+			throw Exceptions::CompressError("ZStd compression dictionary creation failed.");
+		}
+		return result;
+	}
+
+	// 圧縮レベルは辞書の作成時のものが使われる
+	inline size_t ZStdCompress(ZSTD_CCtx* context, const ZSTD_CDict* dictionary, std::span<const uint8_t> data, std::vector<uint8_t>& dest) {
+		const size_t bound = ZSTD_compressBound(data.size());
+		if (ZSTD_isError(bound)) {
+			throw Exceptions::CompressError("ZStd compression bound calculation failed");
+		}
+
+		const size_t oldSize = dest.size();
+		dest.resize(oldSize + bound);
+		const size_t compressedSize = ZSTD_compress_usingCDict(context, dest.data() + oldSize, bound, data.data(), data.size(), dictionary);
+		if (ZSTD_isError(compressedSize)) {
+			dest.resize(oldSize);
+			throw Exceptions::CompressError("ZStd compression failed");
+		}
+		dest.resize(oldSize + compressedSize);
+		return compressedSize;
+	}
+
+	// samplesを連結したものと、それぞれのサイズから辞書を学習する
+	// サンプルが少なすぎるなどで学習できなければ、空のvectorを返す
+	inline std::vector<uint8_t> TrainZStdDictionary(std::span<const uint8_t> samples, std::span<const size_t> sampleSizes, size_t maxDictionarySize) {
+		std::vector<uint8_t> dictionary(maxDictionarySize);
+		const size_t size = ZDICT_trainFromBuffer(
+			dictionary.data(), dictionary.size(),
+			samples.data(), sampleSizes.data(), static_cast<unsigned>(sampleSizes.size()));
+		if (ZDICT_isError(size)) {
+			return {};
+		}
+		dictionary.resize(size);
+		return dictionary;
+	}
+
+	struct ZStdDecompressionContextDeleter {
+		void operator()(ZSTD_DCtx* context) const noexcept {
+			ZSTD_freeDCtx(context);
+		}
+	};
+
+	using ZStdDecompressionContext = std::unique_ptr<ZSTD_DCtx, ZStdDecompressionContextDeleter>;
+
+	inline ZStdDecompressionContext CreateZStdDecompressionContext() {
+		ZStdDecompressionContext context(ZSTD_createDCtx());
+		if (!context) {
+			throw Exceptions::CompressError("ZStd decompression context creation failed.");
+		}
+		return context;
+	}
+
+	// 展開の度にコンテキストを作り直すと、小さいデータでは展開そのものより高くつくので、スレッド毎に使い回す
+	inline ZSTD_DCtx* GetThreadLocalZStdDecompressionContext() {
+		thread_local ZStdDecompressionContext context = CreateZStdDecompressionContext();
+		return context.get();
+	}
+
+	// destに直接展開し、展開後のサイズを返す
+	inline size_t ZStdDecompress(ZSTD_DCtx* context, std::span<const uint8_t> data, std::span<uint8_t> dest) {
+		size_t result = ZSTD_decompressDCtx(context, dest.data(), dest.size(), data.data(), data.size());
 		if (ZSTD_isError(result)) {
 			throw Exceptions::CompressError("ZStd decompression failed.");
 		}
+		return result;
+	}
+
+	inline size_t ZStdDecompress(std::span<const uint8_t> data, std::span<uint8_t> dest) {
+		return ZStdDecompress(GetThreadLocalZStdDecompressionContext(), data, dest);
+	}
+
+	struct ZStdDecompressionDictionaryDeleter {
+		void operator()(ZSTD_DDict* dictionary) const noexcept {
+			ZSTD_freeDDict(dictionary);
+		}
+	};
+
+	// 辞書を解析済みの状態で持つ、読み取り専用なので複数のスレッドで共有できる
+	using ZStdDecompressionDictionary = std::unique_ptr<ZSTD_DDict, ZStdDecompressionDictionaryDeleter>;
+
+	inline ZStdDecompressionDictionary CreateZStdDecompressionDictionary(std::span<const uint8_t> dictionary) {
+		ZStdDecompressionDictionary result(ZSTD_createDDict(dictionary.data(), dictionary.size()));
+		if (!result) {
+			throw Exceptions::CompressError("ZStd decompression dictionary creation failed.");
+		}
+		return result;
+	}
+
+	inline size_t ZStdDecompress(ZSTD_DCtx* context, const ZSTD_DDict* dictionary, std::span<const uint8_t> data, std::span<uint8_t> dest) {
+		size_t result = ZSTD_decompress_usingDDict(context, dest.data(), dest.size(), data.data(), data.size(), dictionary);
+		if (ZSTD_isError(result)) {
+			throw Exceptions::CompressError("ZStd decompression failed.");
+		}
+		return result;
+	}
+
+	inline std::vector<uint8_t> ZStdDecompress(std::span<const uint8_t> data, size_t decompressedSize) {
+		std::vector<uint8_t> decompressedData(decompressedSize);
+		ZStdDecompress(data, decompressedData);
 		return decompressedData;
 	}
 
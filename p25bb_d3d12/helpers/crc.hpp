@@ -1,6 +1,21 @@
 #pragma once
 #include <cstdint>
-#include <vector>
+#include <cstring>
+#include <array>
+#include <bit>
+#include <span>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define PECS_CRC_PCLMUL_AVAILABLE
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PECS_CRC_PCLMUL_TARGET
+#else
+#include <cpuid.h>
+#define PECS_CRC_PCLMUL_TARGET __attribute__((target("pclmul,ssse3")))
+#endif
+#endif
 
 namespace PameECS::Helpers::CRC {
 	class CRC64ECMACalculator {
@@ -9,23 +24,47 @@ namespace PameECS::Helpers::CRC {
 		static constexpr uint64_t initialValue = 0x000000000000000ULL;
 		static constexpr uint64_t xorOut = 0x0000000000000000ULL;
 
-		CRC64ECMACalculator() {
-			m_createTable();
+		CRC64ECMACalculator() = default;
+
+		uint64_t Calculate(std::span<const uint8_t> data) const {
+			return m_update(initialValue, data) ^ xorOut;
+		}
+
+		// 分割されたデータを順に渡すと、全体をCalculateしたのと同じ値になる
+		void Update(std::span<const uint8_t> data) {
+			m_crc = m_update(m_crc, data);
+		}
+
+		uint64_t GetValue() const {
+			return m_crc ^ xorOut;
+		}
+
+		void Reset() {
+			m_crc = initialValue;
 		}
 
-		uint64_t Calculate(const std::vector<uint8_t>& data) const {
-			uint64_t crc = initialValue;
-			for (size_t i = 0; i < data.size(); ++i) {
-				uint8_t index = static_cast<uint8_t>((crc >> 56) ^ data[i]);
-				crc = (crc << 8) ^ m_table[index];
+		// 連続するデータA, BのCRCから、A + B全体のCRCを求める
+		// 分割して別々のスレッドで計算したCRCをまとめるのに使う
+		static uint64_t Combine(uint64_t crcA, uint64_t crcB, uint64_t sizeB) {
+			static_assert(initialValue == 0 && xorOut == 0, "Combine assumes that initialValue and xorOut are 0.");
+
+			// crc(A + B) = crc(A) * x^(8 * sizeB) mod P ^ crc(B)
+			const auto& powers = m_getBytePowers();
+			uint64_t shift = 1;
+			for (size_t k = 0; sizeB != 0; ++k, sizeB >>= 1) {
+				if (sizeB & 1) {
+					shift = m_multiplyMod(shift, powers[k]);
+				}
 			}
 
-			return crc ^ xorOut;
+			return m_multiplyMod(crcA, shift) ^ crcB;
 		}
 	private:
-		std::vector<uint64_t> m_table;
-		void m_createTable() {
-			m_table.resize(256);
+		using TableType = std::array<std::array<uint64_t, 256>, 8>;
+
+		// tables[k][i]は、バイトiの後ろにkバイトの0が続く場合の剰余
+		static constexpr TableType m_createTables() {
+			TableType tables{};
 			for (uint64_t i = 0; i < 256; ++i) {
 				uint64_t rem = i << 56;
 				for (int j = 0; j < 8; ++j) {
@@ -36,8 +75,199 @@ namespace PameECS::Helpers::CRC {
 						rem <<= 1;
 					}
 				}
-				m_table[i] = rem;
+				tables[0][i] = rem;
+			}
+
+			for (size_t k = 1; k < tables.size(); ++k) {
+				for (size_t i = 0; i < 256; ++i) {
+					const uint64_t previous = tables[k - 1][i];
+					tables[k][i] = (previous << 8) ^ tables[0][previous >> 56];
+				}
+			}
+
+			return tables;
+		}
+
+		// x^n mod polynomial
+		static constexpr uint64_t m_xPowMod(size_t n) {
+			uint64_t rem = 1;
+			for (size_t i = 0; i < n; ++i) {
+				rem = (rem & (1ULL << 63)) ? ((rem << 1) ^ polynomial) : (rem << 1);
+			}
+			return rem;
+		}
+
+		// a * b mod polynomial
+		static constexpr uint64_t m_multiplyMod(uint64_t a, uint64_t b) {
+			uint64_t result = 0;
+			for (int i = 63; i >= 0; --i) {
+				result = (result & (1ULL << 63)) ? ((result << 1) ^ polynomial) : (result << 1);
+				if (a & (1ULL << i)) {
+					result ^= b;
+				}
+			}
+			return result;
+		}
+
+		// powers[k]はx^(8 * 2^k) mod polynomial
+		static constexpr std::array<uint64_t, 64> m_createBytePowers() {
+			std::array<uint64_t, 64> powers{};
+			powers[0] = m_xPowMod(8);
+			for (size_t k = 1; k < powers.size(); ++k) {
+				powers[k] = m_multiplyMod(powers[k - 1], powers[k - 1]);
+			}
+			return powers;
+		}
+
+		static const std::array<uint64_t, 64>& m_getBytePowers() {
+			static constexpr std::array<uint64_t, 64> powers = m_createBytePowers();
+			return powers;
+		}
+
+		static const TableType& m_getTables() {
+			static constexpr TableType tables = m_createTables();
+			return tables;
+		}
+
+		static uint64_t m_update(uint64_t crc, std::span<const uint8_t> data) {
+#ifdef PECS_CRC_PCLMUL_AVAILABLE
+			// 短いデータでは畳み込みの準備と後始末の方が高くつく
+			if (data.size() >= 128 && m_isPclmulSupported()) {
+				return m_updatePclmul(crc, data);
+			}
+#endif
+			return m_updateSlicing(crc, data);
+		}
+
+		// slicing-by-8、8バイトずつテーブルを引く
+		static uint64_t m_updateSlicing(uint64_t crc, std::span<const uint8_t> data) {
+			const TableType& tables = m_getTables();
+			const uint8_t* p = data.data();
+			size_t size = data.size();
+
+			while (size >= 8) {
+				uint64_t word = 0;
+				std::memcpy(&word, p, sizeof(word));
+				if constexpr (std::endian::native == std::endian::little) {
+					word = std::byteswap(word);
+				}
+				crc ^= word;
+
+				crc = tables[7][crc >> 56]
+					^ tables[6][(crc >> 48) & 0xFF]
+					^ tables[5][(crc >> 40) & 0xFF]
+					^ tables[4][(crc >> 32) & 0xFF]
+					^ tables[3][(crc >> 24) & 0xFF]
+					^ tables[2][(crc >> 16) & 0xFF]
+					^ tables[1][(crc >> 8) & 0xFF]
+					^ tables[0][crc & 0xFF];
+
+				p += 8;
+				size -= 8;
+			}
+
+			for (size_t i = 0; i < size; ++i) {
+				crc = (crc << 8) ^ tables[0][static_cast<uint8_t>((crc >> 56) ^ p[i])];
+			}
+
+			return crc;
+		}
+
+#ifdef PECS_CRC_PCLMUL_AVAILABLE
+		static bool m_isPclmulSupported() {
+			static const bool supported = [] {
+#ifdef _MSC_VER
+				int info[4] = {};
+				__cpuid(info, 1);
+				const unsigned int ecx = static_cast<unsigned int>(info[2]);
+#else
+				unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+				if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+					return false;
+				}
+#endif
+				constexpr unsigned int pclmulBit = 1U << 1;
+				constexpr unsigned int ssse3Bit = 1U << 9;
+				return (ecx & pclmulBit) && (ecx & ssse3Bit);
+			}();
+			return supported;
+		}
+
+		// 先頭のバイトが最上位になるように並べ替えるマスク
+		static __m128i m_byteReverseMask() {
+			return _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		}
+
+		PECS_CRC_PCLMUL_TARGET
+		static __m128i m_load(const uint8_t* p, __m128i byteReverse) {
+			return _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), byteReverse);
+		}
+
+		// xの上位と下位をそれぞれconstantsの上位と下位と掛けて、後ろのデータと同じ剰余になるように畳み込む
+		PECS_CRC_PCLMUL_TARGET
+		static __m128i m_fold(__m128i x, __m128i constants) {
+			return _mm_xor_si128(
+				_mm_clmulepi64_si128(x, constants, 0x11),
+				_mm_clmulepi64_si128(x, constants, 0x00));
+		}
+
+		// 4レーン(64バイト)ずつcarry-less乗算で畳み込み、余りをslicing-by-8で処理する
+		PECS_CRC_PCLMUL_TARGET
+		static uint64_t m_updatePclmul(uint64_t crc, std::span<const uint8_t> data) {
+			// 上位64ビットにx^(d+64) mod P、下位64ビットにx^d mod P
+			auto foldConstants = [](size_t distance) {
+				return _mm_set_epi64x(
+					static_cast<long long>(m_xPowMod(distance + 64)),
+					static_cast<long long>(m_xPowMod(distance)));
+			};
+			static const __m128i fold512 = foldConstants(512);
+			static const __m128i fold384 = foldConstants(384);
+			static const __m128i fold256 = foldConstants(256);
+			static const __m128i fold128 = foldConstants(128);
+
+			const __m128i byteReverse = m_byteReverseMask();
+			auto load = [&byteReverse](const uint8_t* p) {
+				return m_load(p, byteReverse);
+			};
+
+			const uint8_t* p = data.data();
+			size_t size = data.size();
+
+			__m128i x0 = _mm_xor_si128(load(p), _mm_set_epi64x(static_cast<long long>(crc), 0));
+			__m128i x1 = load(p + 16);
+			__m128i x2 = load(p + 32);
+			__m128i x3 = load(p + 48);
+			p += 64;
+			size -= 64;
+
+			while (size >= 64) {
+				x0 = _mm_xor_si128(m_fold(x0, fold512), load(p));
+				x1 = _mm_xor_si128(m_fold(x1, fold512), load(p + 16));
+				x2 = _mm_xor_si128(m_fold(x2, fold512), load(p + 32));
+				x3 = _mm_xor_si128(m_fold(x3, fold512), load(p + 48));
+				p += 64;
+				size -= 64;
+			}
+
+			__m128i x = _mm_xor_si128(
+				_mm_xor_si128(m_fold(x0, fold384), m_fold(x1, fold256)),
+				_mm_xor_si128(m_fold(x2, fold128), x3));
+
+			while (size >= 16) {
+				x = _mm_xor_si128(m_fold(x, fold128), load(p));
+				p += 16;
+				size -= 16;
 			}
+
+			// 畳み込んだ128ビットは、初期値0でCRCを取れば元のデータと同じ剰余になる
+			alignas(16) uint8_t folded[16];
+			_mm_store_si128(reinterpret_cast<__m128i*>(folded), _mm_shuffle_epi8(x, byteReverse));
+
+			crc = m_updateSlicing(0, folded);
+			return m_updateSlicing(crc, { p, size });
 		}
+#endif
+
+		uint64_t m_crc = initialValue;
 	};
 }
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+namespace PameECS::Helpers::Hash {
+	// FNV-1a (64ビット)、アーカイブに書き込まれるハッシュにも使うので、結果を変えないこと
+	constexpr uint64_t Fnv1a64(std::string_view data) {
+		constexpr uint64_t offsetBasis = 0xCBF29CE484222325ULL;
+		constexpr uint64_t prime = 0x00000100000001B3ULL;
+
+		uint64_t hash = offsetBasis;
+		for (char c : data) {
+			hash ^= static_cast<uint8_t>(c);
+			hash *= prime;
+		}
+
+		return hash;
+	}
+}
@@ -1,10 +1,11 @@
 #pragma once
 #include <filesystem>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace PameECS::Helpers::Path {
-	std::vector<std::string> PathToVector(const std::filesystem::path& path) {
+	inline std::vector<std::string> PathToVector(const std::filesystem::path& path) {
 		std::vector<std::string> result;
 
 		for (const auto& part : path) {
@@ -13,4 +14,81 @@ namespace PameECS::Helpers::Path {
 
 		return result;
 	}
+
+	// アーカイブなどの仮想パスの区切り文字を'/'に揃え、空の要素を取り除く
+	inline std::string NormalizeVirtualPath(std::string_view virtualPath) {
+		std::string result;
+		result.reserve(virtualPath.size());
+
+		size_t partBegin = 0;
+		while (partBegin <= virtualPath.size()) {
+			size_t partEnd = virtualPath.find_first_of("/\\", partBegin);
+			if (partEnd == std::string_view::npos) {
+				partEnd = virtualPath.size();
+			}
+
+			if (partEnd > partBegin) {
+				if (!result.empty()) {
+					result += '/';
+				}
+				result.append(virtualPath.substr(partBegin, partEnd - partBegin));
+			}
+
+			partBegin = partEnd + 1;
+		}
+
+		return result;
+	}
+
+	// NormalizeVirtualPathで変わらないパスか、メモリは確保しない
+	inline bool IsNormalizedVirtualPath(std::string_view virtualPath) noexcept {
+		return virtualPath.find('\\') == std::string_view::npos
+			&& virtualPath.find("//") == std::string_view::npos
+			&& !virtualPath.starts_with('/')
+			&& !virtualPath.ends_with('/');
+	}
+
+	// '/'区切りのパスがglobのパターンに一致するか、メモリは確保しない
+	// '*'は'/'以外の0文字以上、'?'は'/'以外の1文字、'**'は'/'を含む0文字以上に一致する("a/**/b"は"a/b"にも一致する)
+	inline bool MatchGlob(std::string_view pattern, std::string_view path) noexcept {
+		while (!pattern.empty()) {
+			if (pattern.starts_with("**")) {
+				pattern.remove_prefix(2);
+				// "**/"は0個のディレクトリにも一致する
+				if (pattern.starts_with('/') && MatchGlob(pattern.substr(1), path)) {
+					return true;
+				}
+				for (size_t i = 0; i <= path.size(); ++i) {
+					if (MatchGlob(pattern, path.substr(i))) {
+						return true;
+					}
+				}
+				return false;
+			}
+
+			if (pattern.front() == '*') {
+				pattern.remove_prefix(1);
+				for (size_t i = 0; i <= path.size(); ++i) {
+					if (MatchGlob(pattern, path.substr(i))) {
+						return true;
+					}
+					if (i < path.size() && path[i] == '/') {
+						break;
+					}
+				}
+				return false;
+			}
+
+			if (path.empty()) {
+				return false;
+			}
+			if (pattern.front() == '?' ? path.front() == '/' : pattern.front() != path.front()) {
+				return false;
+			}
+			pattern.remove_prefix(1);
+			path.remove_prefix(1);
+		}
+
+		return path.empty();
+	}
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include "../macros/assertion.hpp"
 
 namespace PameECS::TemplateTypes {
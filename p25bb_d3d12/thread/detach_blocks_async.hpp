@@ -0,0 +1,93 @@
+#pragma once
+#include <BS_thread_pool.hpp/BS_thread_pool.hpp>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+namespace PameECS::Thread {
+	// [firstIndex, indexAfterLast)をblockSize個ずつのブロックに分けてdetach_blocksで実行し、完了をstd::futureで受け取る
+	// 最後に終わったブロックのスレッドでonCompleteを呼んでその戻り値をfutureに入れるので、プールのスレッドがfuture.get()で待つことはない
+	// 途中のブロックで例外が発生した場合は、最初の例外がfutureに入りonCompleteは呼ばれない
+	template<typename T, typename Block, typename OnComplete>
+	auto DetachBlocksAsync(
+		BS::thread_pool<0U>& threadPool,
+		const T firstIndex,
+		const T indexAfterLast,
+		Block&& block,
+		const size_t blockSize,
+		OnComplete&& onComplete) -> std::future<std::invoke_result_t<OnComplete>> {
+		using ResultType = std::invoke_result_t<OnComplete>;
+
+		struct State {
+			explicit State(std::decay_t<Block>&& block, std::decay_t<OnComplete>&& onComplete)
+				: block(std::move(block)), onComplete(std::move(onComplete)) {}
+
+			std::decay_t<Block> block;
+			std::decay_t<OnComplete> onComplete;
+			std::promise<ResultType> promise;
+			std::atomic_size_t remainingBlocks{ 0 };
+			std::exception_ptr exception;
+			std::mutex exceptionMutex;
+
+			void Complete() {
+				if (exception) {
+					promise.set_exception(exception);
+					return;
+				}
+
+				try {
+					if constexpr (std::is_void_v<ResultType>) {
+						onComplete();
+						promise.set_value();
+					}
+					else {
+						promise.set_value(onComplete());
+					}
+				}
+				catch (...) {
+					promise.set_exception(std::current_exception());
+				}
+			}
+		};
+
+		auto state = std::make_shared<State>(std::decay_t<Block>(std::forward<Block>(block)), std::decay_t<OnComplete>(std::forward<OnComplete>(onComplete)));
+		auto future = state->promise.get_future();
+
+		const size_t count = indexAfterLast > firstIndex ? static_cast<size_t>(indexAfterLast - firstIndex) : 0;
+		const size_t numBlocks = (count + std::max<size_t>(1, blockSize) - 1) / std::max<size_t>(1, blockSize);
+
+		// detach_blocksと同じ分割をして、実際に投げられるブロック数を知る
+		const size_t actualNumBlocks = BS::blocks<T>(firstIndex, indexAfterLast, numBlocks).get_num_blocks();
+		if (actualNumBlocks == 0) {
+			state->Complete();
+			return future;
+		}
+
+		state->remainingBlocks = actualNumBlocks;
+
+		threadPool.detach_blocks(
+			firstIndex, indexAfterLast,
+			[state](const T start, const T end) {
+				try {
+					state->block(start, end);
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> lock(state->exceptionMutex);
+					if (!state->exception) {
+						state->exception = std::current_exception();
+					}
+				}
+
+				if (state->remainingBlocks.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					state->Complete();
+				}
+			},
+			numBlocks);
+
+		return future;
+	}
+}
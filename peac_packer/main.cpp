@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <BS_thread_pool.hpp/BS_thread_pool.hpp>
+#include <exceptions/exception_base.hpp>
+
+#include "file/archive/archive_writer.hpp"
+
+namespace {
+	void PrintUsage() {
+		std::cerr
+			<< "Usage: peac_packer <source directory> <output file> [options]\n"
+			<< "Options:\n"
+			<< "  --level <n>              ZStandard compression level (default: 3)\n"
+			<< "  --threads <n>            Number of compression threads (default: hardware concurrency)\n"
+			<< "  --version <1.0-1.4>      Archive format version (default: 1.4)\n"
+			<< "  --chunk-size <bytes>     Data chunk size, a power of two (default: 2048, 1.2 or later)\n"
+			<< "  --no-hash-index          Do not write the path hash index (1.1 or later)\n"
+			<< "  --no-align               Do not align file data to chunk boundaries\n"
+			<< "  --dictionary <bytes>     Train a zstd dictionary of up to this size for the data chunks (1.4 or later)\n"
+			<< "  --store <extension>      Store files with this extension without compression, e.g. .ogg (1.3 or later)\n";
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		PrintUsage();
+		return 1;
+	}
+
+	const std::string sourceDirectory = argv[1];
+	const std::string outputPath = argv[2];
+	size_t threadCount = std::thread::hardware_concurrency();
+	PameECS::File::Archive::ArchiveWriter::Properties properties;
+	std::vector<std::string> storedExtensions;
+
+	try {
+		for (int i = 3; i < argc; ++i) {
+			const std::string_view option = argv[i];
+			const bool hasValue = i + 1 < argc;
+
+			if (option == "--level" && hasValue) {
+				properties.compressionLevel = std::stoi(argv[++i]);
+			}
+			else if (option == "--threads" && hasValue) {
+				threadCount = std::stoul(argv[++i]);
+			}
+			else if (option == "--version" && hasValue) {
+				const std::string_view version = argv[++i];
+				if (version == "1.0") {
+					properties.versionMinor = 0;
+				}
+				else if (version == "1.1") {
+					properties.versionMinor = 1;
+				}
+				else if (version == "1.2") {
+					properties.versionMinor = 2;
+				}
+				else if (version == "1.3") {
+					properties.versionMinor = 3;
+				}
+				else if (version == "1.4") {
+					properties.versionMinor = 4;
+				}
+				else {
+					PrintUsage();
+					return 1;
+				}
+			}
+			else if (option == "--chunk-size" && hasValue) {
+				properties.chunkSize = std::stoull(argv[++i]);
+			}
+			else if (option == "--no-hash-index") {
+				properties.writeHashIndex = false;
+			}
+			else if (option == "--dictionary" && hasValue) {
+				properties.dictionarySize = std::stoull(argv[++i]);
+			}
+			else if (option == "--store" && hasValue) {
+				storedExtensions.emplace_back(argv[++i]);
+			}
+			else if (option == "--no-align") {
+				properties.alignFilesToChunks = false;
+			}
+			else {
+				PrintUsage();
+				return 1;
+			}
+		}
+	}
+	catch (const std::exception&) {
+		PrintUsage();
+		return 1;
+	}
+
+	if (!storedExtensions.empty()) {
+		properties.storedExtensions = std::move(storedExtensions);
+	}
+
+	try {
+		auto threadPool = std::make_shared<BS::thread_pool<0U>>(std::max<size_t>(1, threadCount));
+		PameECS::File::Archive::ArchiveWriter writer(threadPool, properties);
+		writer.AddDirectoryTree(sourceDirectory);
+		writer.Write(outputPath);
+	}
+	catch (const Pame::Exceptions::ExceptionBase& e) {
+		std::cerr << e.GetExceptionTypeName() << ": " << e.what() << "\n";
+		return 1;
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}